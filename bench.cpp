@@ -0,0 +1,282 @@
+#include "liberc-crypto.hpp"
+#include "threading.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+using namespace ERCLIB;
+
+//! Best of several timed runs, in nanoseconds per call; the best run is the one least disturbed by the rest of the machine
+template<class F> double nsPerCall(F&& fn, size_t calls, int runs = 7) {
+	double best = 1e300;
+	for (int r = 0; r < runs; r++) {
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < calls; i++) fn();
+		const std::chrono::duration<double, std::nano> took = std::chrono::steady_clock::now() - start;
+		best = std::min(best, took.count() / calls);
+	}
+	return best;
+}
+
+//! As nsPerCall(), with the call count raised until one run takes at least 10ms
+template<class F> double nsPerCallTimed(F&& fn) {
+	size_t calls = 1;
+	while (calls < (size_t(1) << 24) && nsPerCall(fn, calls, 1) * calls < 1e7) calls *= 4;
+	return nsPerCall(fn, calls, 3);
+}
+
+//! One JSON result row; \c variant is empty for the kernels, which take no parameters
+void stageRow(bool& first, const char* stage, const std::string& variant, size_t bytes, double ns, const std::string& error = "") {
+	std::cout << (first ? "\n" : ",\n") << "    {\"stage\": \"" << stage << "\", \"variant\": ";
+	if (variant.empty()) std::cout << "null"; else std::cout << '"' << variant << '"';
+	std::cout << ", \"bytes\": " << bytes;
+	if (!error.empty()) {
+		std::cout << ", \"error\": \"" << error << "\"}";
+	} else {
+		std::cout << std::setprecision(6) << ", \"ns_per_call\": " << ns << ", \"calls_per_sec\": " << (1e9 / ns) << ", \"ns_per_byte\": " << (ns / std::max<size_t>(bytes, 1)) << '}';
+	}
+	first = false;
+}
+
+/********!
+ * @brief
+ * 			Per-stage timings as JSON, so a slow release can be traced
+ * 			to the stage that regressed.
+ * 
+ * @details
+ * 			The kernels, \c split() and \c fuse() are timed at every
+ * 			size from 1 byte to \c maxBytes (powers of sixteen, then
+ * 			\c maxBytes itself). \c intertwine() only ever sees a
+ * 			digest, so it is timed at each variant's capacity. The full
+ * 			\c hash() runs for every variant at every size, with a reused
+ * 			arena; sizes a variant cannot hash get an \c error instead.
+ ********/
+void benchStages(size_t maxBytes) {
+	std::vector<size_t> sizes;
+	for (size_t n = 1; n < maxBytes; n *= 16) sizes.push_back(n);
+	sizes.push_back(maxBytes);
+	NACHA::DRBG gen(strToBVec("bench fixture"));
+	const std::vector<byte> data = gen.generate(maxBytes);
+	std::vector<byte> out(NACHA::low::permuteASize(maxBytes)), scratch(NACHA::low::permuteBSize(maxBytes)), arena;
+	//! intertwine() reads two digests and hash() writes one, so size these by capacity rather than \c maxBytes
+	size_t maxCapac = 0;
+	for (const NACHA::Variant& v : NACHA::variants()) maxCapac = std::max<size_t>(maxCapac, v.capac);
+	const std::vector<byte> pair = gen.generate(2 * maxCapac);
+	std::vector<byte> digest(maxCapac);
+	volatile byte sink = 0;
+	bool first = true;
+	
+	std::cout << "{\n  \"benchmark\": \"nacha-stages\",\n  \"results\": [";
+	for (size_t n : sizes) {
+		using namespace NACHA::low;
+		stageRow(first, "permuteA", "", n, nsPerCallTimed([&] {sink ^= byte(permuteA(data.data(), n, out.data()));}));
+		stageRow(first, "permuteB", "", n, nsPerCallTimed([&] {sink ^= byte(permuteB(data.data(), n, out.data()));}));
+		stageRow(first, "permuteC", "", n, nsPerCallTimed([&] {sink ^= byte(permuteC(data.data(), n, out.data(), scratch.data()));}));
+		stageRow(first, "mix", "", n, nsPerCallTimed([&] {sink ^= byte(mix(data.data(), n, 1, out.data()));}));
+		const std::vector<byte> in(data.begin(), data.begin() + n);
+		stageRow(first, "split", "", n, nsPerCallTimed([&] {sink ^= byte(NACHA::split(in, 7).size());}));
+		const std::vector<std::vector<byte>> chunks = NACHA::split(in, 7);
+		stageRow(first, "fuse", "", n, nsPerCallTimed([&] {sink ^= byte(NACHA::fuse(chunks).size());}));
+	}
+	for (const NACHA::Variant& v : NACHA::variants()) {
+		stageRow(first, "intertwine", v.name, v.capac, nsPerCallTimed([&] {
+			NACHA::low::intertwine(pair.data(), pair.data() + v.capac, v.capac, digest.data());
+			sink ^= digest[0];
+		}));
+	}
+	for (const NACHA::Variant& v : NACHA::variants()) {
+		for (size_t n : sizes) {
+			try {
+				const NACHA::HashPlan plan(n, v.capac, v.blkA, v.blkB);
+				if (arena.size() < plan.arenaSize) arena.resize(plan.arenaSize);
+				stageRow(first, "hash", v.name, n, nsPerCallTimed([&] {
+					NACHA::hash(plan, data.data(), arena.data(), digest.data());
+					sink ^= digest[0];
+				}));
+			} catch (const std::exception& e) {
+				stageRow(first, "hash", v.name, n, 0, e.what());
+			}
+		}
+	}
+	std::cout << "\n  ]\n}\n";
+}
+
+//! Latency of one short message: an arena reused across calls, as \c Hasher keeps, against a fresh heap arena per call
+void benchShort() {
+	std::cout << "Short-message latency (ns per call)\n"
+		<< std::setw(8) << "variant" << std::setw(7) << "bytes" << std::setw(12) << "reused" << std::setw(12) << "fresh" << '\n';
+	volatile byte sink = 0;
+	for (const char* name : {"128", "256", "512E", "768E"}) {
+		const NACHA::Variant& v = NACHA::findVariant(name);
+		for (size_t n : {0, 8, 16, 32, 63}) {
+			std::vector<byte> in(n), kept;
+			for (size_t i = 0; i < n; i++) in[i] = byte((i * 131) + 7);
+			const NACHA::HashPlan plan(n, v.capac, v.blkA, v.blkB);
+			byte out[96];
+			const double reused = nsPerCall([&] {
+				NACHA::hash(plan, in.data(), kept, out);
+				sink ^= out[0];
+			}, 2000);
+			const double fresh = nsPerCall([&] {
+				std::vector<byte> arena;
+				NACHA::hash(plan, in.data(), arena, out);
+				sink ^= out[0];
+			}, 2000);
+			std::cout << std::setw(8) << name << std::setw(7) << n << std::fixed << std::setprecision(0)
+				<< std::setw(12) << reused << std::setw(12) << fresh << '\n';
+		}
+	}
+}
+
+//! Longest length at or below \c n that legacy NACHA accepts, or 0; past 64KB many lengths throw
+size_t legacyLength(size_t n, const NACHA::Variant& v) {
+	for (size_t tries = 0; tries < 250000 && n; tries++, n--) {
+		try {
+			NACHA::HashPlan(n, v.capac, v.blkA, v.blkB);
+			return n;
+		} catch (const std::invalid_argument&) {}
+	}
+	return 0;
+}
+
+//! Throughput of NACHA against NACHA-L, in MB/s of input, with the 256 parameters
+void benchLong() {
+	const NACHA::Variant& v = NACHA::findVariant("256");
+	std::cout << "Throughput, 256 parameters (MB/s)\n"
+		<< std::setw(10) << "bytes" << std::setw(12) << "NACHA" << std::setw(12) << "NACHA-L" << std::setw(12) << "at length" << '\n';
+	volatile byte sink = 0;
+	for (size_t n : {size_t(1) << 10, size_t(1) << 14, size_t(1) << 16, size_t(1) << 20, size_t(1) << 24}) {
+		std::vector<byte> in(n);
+		for (size_t i = 0; i < n; i++) in[i] = byte((i * 131) + 7);
+		const size_t calls = std::max<size_t>(1, (size_t(1) << 21) / n), runs = (n > (size_t(1) << 20)) ? 2 : 5;
+		const double wide = nsPerCall([&] {sink ^= NACHA::hashL(in, v.capac, v.blkA, v.blkB)[0];}, calls, runs);
+		
+		//Legacy NACHA runs at the nearest length it accepts, where it also drops whatever its ushort chunks cannot hold
+		const size_t m = legacyLength(n, v);
+		std::vector<byte> part(in.begin(), in.begin() + m);
+		const double legacy = m ? nsPerCall([&] {sink ^= NACHA::hash(part, v.capac, v.blkA, v.blkB)[0];}, calls, runs) : 0;
+		std::cout << std::setw(10) << n << std::fixed << std::setprecision(1)
+			<< std::setw(12) << (m ? (m * 1e3 / legacy) : 0.0) << std::setw(12) << (n * 1e3 / wide) << std::setw(12) << m << '\n';
+	}
+}
+
+//! Time to derive one key, for picking deriveKey() costs that fit a latency budget
+void benchKdf() {
+	std::cout << "deriveKey latency (ms per key)\n"
+		<< std::setw(10) << "memory KB" << std::setw(8) << "passes" << std::setw(8) << "lanes" << std::setw(12) << "ms" << '\n';
+	const std::vector<byte> password = strToBVec("correct horse battery staple"), salt = strToBVec("per-user salt");
+	volatile byte sink = 0;
+	for (uint mem : {256u, 1024u, 4096u}) {
+		for (uint lanes : {1u, 4u}) {
+			const double ns = nsPerCall([&] {sink ^= NACHA::deriveKey(password, salt, 60, 1, mem, lanes)[0];}, 1, 3);
+			std::cout << std::setw(10) << mem << std::setw(8) << 1 << std::setw(8) << lanes << std::fixed << std::setprecision(1) << std::setw(12) << (ns / 1e6) << '\n';
+		}
+	}
+}
+
+//! DRBG output rate, single-threaded and across every core
+void benchDrbg() {
+	std::cout << "DRBG throughput (MB/s)\n" << std::setw(10) << "bytes" << std::setw(8) << "workers" << std::setw(12) << "MB/s" << '\n';
+	NACHA::DRBG gen(strToBVec("bench fixture"));
+	std::vector<byte> out(size_t(1) << 24);
+	for (uint workers : {1u, Threading::defaultWorkers()}) {
+		const double ns = nsPerCall([&] {gen.generate(out.data(), out.size(), workers);}, 1, 3);
+		std::cout << std::setw(10) << out.size() << std::setw(8) << workers << std::fixed << std::setprecision(1) << std::setw(12) << (out.size() * 1e3 / ns) << '\n';
+	}
+}
+
+//! Chunking with fingerprints on random data, then chunk index inserts and lookups
+void benchDedup() {
+	std::cout << "chunkData throughput (MB/s)\n" << std::setw(10) << "bytes" << std::setw(8) << "workers" << std::setw(12) << "MB/s" << '\n';
+	NACHA::DRBG gen(strToBVec("bench fixture"));
+	const std::vector<byte> data = gen.generate(size_t(1) << 24);
+	for (uint workers : {1u, Threading::defaultWorkers()}) {
+		const double ns = nsPerCall([&] {NACHA::chunkData(data.data(), data.size(), NACHA::ChunkParams(), workers);}, 1, 3);
+		std::cout << std::setw(10) << data.size() << std::setw(8) << workers << std::fixed << std::setprecision(1) << std::setw(12) << (data.size() * 1e3 / ns) << '\n';
+	}
+
+	std::cout << "ChunkIndex (ns per call)\n" << std::setw(10) << "records" << std::setw(12) << "insert" << std::setw(12) << "lookup" << '\n';
+	const std::string path = "bench-index.tmp";
+	const size_t records = size_t(1) << 20;
+	std::vector<NACHA::Fingerprint> keys(records);
+	for (NACHA::Fingerprint& k : keys) gen.generate(k.data(), k.size());
+	double insertNs, lookupNs;
+	{
+		std::remove(path.c_str());
+		NACHA::ChunkIndex index(path);
+		size_t i = 0;
+		insertNs = nsPerCall([&] {index.insert(keys[i], i, 8192); i++;}, records, 1);
+		NACHA::ChunkIndex::Record found;
+		i = 0;
+		lookupNs = nsPerCall([&] {index.lookup(keys[i++ % records], found);}, records, 3);
+	}
+	std::remove(path.c_str());
+	std::cout << std::setw(10) << records << std::fixed << std::setprecision(1) << std::setw(12) << insertNs << std::setw(12) << lookupNs << '\n';
+}
+
+//! Records per second through RecordPipeline, against calling hashData256 in a loop
+void benchPipeline() {
+	std::cout << "RecordPipeline throughput (records/s, 256-byte records)\n" << std::setw(10) << "records" << std::setw(8) << "workers" << std::setw(14) << "records/s" << '\n';
+	const size_t records = 4096;
+	std::vector<byte> record = NACHA::DRBG(strToBVec("bench fixture")).generate(256);
+	volatile byte sink = 0;
+	const double loopNs = nsPerCall([&] {sink ^= hashData256(record)[0];}, records, 3);
+	std::cout << std::setw(10) << records << std::setw(8) << "loop" << std::fixed << std::setprecision(0) << std::setw(14) << (1e9 / loopNs) << '\n';
+	for (uint workers : {1u, Threading::defaultWorkers()}) {
+		NACHA::RecordPipeline pipe(NACHA::findVariant("256"), workers);
+		const double ns = nsPerCall([&] {
+			std::thread producer([&] {for (size_t i = 0; i < records; i++) pipe.push(record.data(), record.size(), i);});
+			NACHA::RecordPipeline::Completion c;
+			for (size_t i = 0; i < records; i++) {
+				pipe.pop(c);
+				sink ^= c.digest[0];
+			}
+			producer.join();
+		}, 1, 3) / records;
+		std::cout << std::setw(10) << records << std::setw(8) << workers << std::fixed << std::setprecision(0) << std::setw(14) << (1e9 / ns) << '\n';
+	}
+}
+
+//! VIPER-1 CBC throughput, with the key schedule rebuilt per call and built once
+void benchViper() {
+	std::cout << "VIPER-1 throughput (MB/s)\n" << std::setw(10) << "bytes" << std::setw(12) << "schedule" << std::setw(12) << "encrypt" << std::setw(12) << "decrypt" << '\n';
+	NACHA::DRBG gen(strToBVec("bench fixture"));
+	const bytevec key = gen.generate(60), iv = gen.generate(12);
+	volatile byte sink = 0;
+	for (size_t bytes : {size_t(24), size_t(24) << 12}) {
+		const bytevec msg = gen.generate(bytes);
+		const double encNs = nsPerCall([&] {sink ^= VIPER1::encrypt(msg, key, iv)[0];}, 1, 5);
+		const double decNs = nsPerCall([&] {sink ^= VIPER1::decrypt(msg, key, iv)[0];}, 1, 5);
+		std::cout << std::setw(10) << bytes << std::setw(12) << "per call" << std::fixed << std::setprecision(2) << std::setw(12) << (bytes * 1e3 / encNs) << std::setw(12) << (bytes * 1e3 / decNs) << '\n';
+		const VIPER1::KeySchedule ks(key);
+		const double encKs = nsPerCall([&] {sink ^= VIPER1::encrypt(msg, ks, iv)[0];}, 1, 5);
+		const double decKs = nsPerCall([&] {sink ^= VIPER1::decrypt(msg, ks, iv)[0];}, 1, 5);
+		std::cout << std::setw(10) << bytes << std::setw(12) << "reused" << std::fixed << std::setprecision(2) << std::setw(12) << (bytes * 1e3 / encKs) << std::setw(12) << (bytes * 1e3 / decKs) << '\n';
+	}
+	//! Decryption splits over threads; encryption is one CBC chain and can't
+	const uint workers = Threading::defaultWorkers();
+	const bytevec msg = gen.generate(size_t(24) << 14);
+	const VIPER1::KeySchedule ks(key);
+	const double decPar = nsPerCall([&] {sink ^= VIPER1::decrypt(msg, ks, iv, workers)[0];}, 1, 5);
+	std::cout << std::setw(10) << msg.size() << std::setw(12) << (std::to_string(workers) + " threads") << std::setw(12) << "-" << std::fixed << std::setprecision(2) << std::setw(12) << (msg.size() * 1e3 / decPar) << '\n';
+	const double ctrEnc = nsPerCall([&] {sink ^= VIPER1::encrypt_ctr(msg, ks, iv, 0, workers)[0];}, 1, 5);
+	const double ctrDec = nsPerCall([&] {sink ^= VIPER1::decrypt_ctr(msg, ks, iv, 0, workers)[0];}, 1, 5);
+	std::cout << std::setw(10) << msg.size() << std::setw(12) << "CTR" << std::fixed << std::setprecision(2) << std::setw(12) << (msg.size() * 1e3 / ctrEnc) << std::setw(12) << (msg.size() * 1e3 / ctrDec) << '\n';
+}
+
+int main(int argc, char** argv) {
+	const std::string only = (argc > 1) ? argv[1] : "";
+	if (only.empty() || only == "short") benchShort();
+	if (only.empty() || only == "long") benchLong();
+	if (only.empty() || only == "kdf") benchKdf();
+	if (only.empty() || only == "drbg") benchDrbg();
+	if (only.empty() || only == "dedup") benchDedup();
+	if (only.empty() || only == "pipeline") benchPipeline();
+	if (only.empty() || only == "viper") benchViper();
+	//! JSON, and a long sweep, so only when asked for: ./bench stages [MAX_BYTES]
+	if (only == "stages") benchStages((argc > 2) ? size_t(std::strtoull(argv[2], nullptr, 10)) : (size_t(64) << 20));
+}
@@ -0,0 +1,41 @@
+#ifndef erclib_bytes_included
+#define erclib_bytes_included
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+typedef unsigned char byte;
+
+namespace ERCLIB {
+namespace Bytes {
+	//! Writes the low \c len bytes of \c v to \c dst, least significant first
+	inline void putLE(byte* dst, uint64_t v, byte len) {
+		for (byte i = 0; i < len; i++) dst[i] = byte(v >> (8 * i));
+	}
+	inline uint64_t getLE(const byte* src, byte len) {
+		uint64_t v = 0;
+		for (byte i = 0; i < len; i++) v |= uint64_t(src[i]) << (8 * i);
+		return v;
+	}
+	
+	//! MurmurHash3's 64-bit finalizer: a bijection that spreads every input bit over the whole word
+	inline uint64_t fmix64(uint64_t k) {
+		k ^= k >> 33; k *= 0xFF51AFD7ED558CCDULL;
+		k ^= k >> 33; k *= 0xC4CEB9FE1A85EC53ULL;
+		k ^= k >> 33;
+		return k;
+	}
+	
+	//! Zeroes memory that is about to go out of scope, without the stores being optimised away
+	inline void wipe(void* p, size_t n) {
+		if (n == 0) return; //an empty vector's data() may be null
+		std::memset(p, 0, n);
+#if defined(__GNUC__)
+		__asm__ __volatile__("" : : "r"(p) : "memory");
+#endif
+	}
+}
+}
+
+#endif
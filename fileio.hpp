@@ -0,0 +1,30 @@
+#ifndef erclib_fileio_included
+#define erclib_fileio_included
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+typedef unsigned char byte;
+
+namespace ERCLIB {
+namespace FileIO {
+	//! Reads exactly \c len bytes at \c offset, or throws; short reads and EINTR are retried
+	inline void preadAll(int fd, uint64_t offset, size_t len, byte* dst) {
+		while (len > 0) {
+			const ssize_t got = ::pread(fd, dst, len, off_t(offset));
+			if (got < 0) {
+				if (errno == EINTR) continue;
+				throw std::runtime_error(std::string("NACHA could not read its input: ") + std::strerror(errno));
+			}
+			if (got == 0) throw std::runtime_error("NACHA input ended early; was it truncated while hashing?");
+			dst += got; offset += uint64_t(got); len -= size_t(got);
+		}
+	}
+}
+}
+
+#endif
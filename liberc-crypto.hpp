@@ -33,61 +33,117 @@
 #include "viper-1.hpp" //! the VIPER-1 Block Cipher
 #include "kobra.hpp" //! the KOBRA Calypcryptographic Algorithm
 #include "nacha.hpp" //! the NACHA Hash Algorithm
+#include "nacha-tree.hpp" //! NACHA Tree mode, for large and incrementally-updated inputs
+#include "nacha-kdf.hpp" //! memory-hard key derivation on NACHA, for VIPER-1 keys and IVs
+#include "nacha-drbg.hpp" //! reproducible pseudo-random bytes from NACHA, in counter mode
+#include "nacha-dedup.hpp" //! content-defined chunking and a chunk index, for deduplicating storage
+#include "nacha-pipeline.hpp" //! lock-free, in-order hashing of many small records on worker threads
 
 //! these don't get compiled into the library; this header file is lightweight, useful definitions without "express" association
 //! this file is meant to be included along with the -lerc-crypto flag.
 namespace ERCLIB {
+	//! Compile-time parameter sets behind each hashData function; Hash256::digest(...) returns a std::array
+	typedef NACHA::Hasher<16, 5, 3> Hash128;
+	typedef NACHA::Hasher<16, 7, 4> Hash128E;
+	typedef NACHA::Hasher<32, 7, 4> Hash256;
+	typedef NACHA::Hasher<32, 9, 5> Hash256E;
+	typedef NACHA::Hasher<48, 9, 5> Hash384;
+	typedef NACHA::Hasher<48, 11, 6> Hash384E;
+	typedef NACHA::Hasher<64, 11, 6> Hash512;
+	typedef NACHA::Hasher<64, 13, 7> Hash512E;
+	typedef NACHA::Hasher<96, 13, 7> Hash768;
+	typedef NACHA::Hasher<96, 15, 8> Hash768E;
+	
+	template<size_t N> inline std::vector<byte> toVector(const std::array<byte, N>& digest) {
+		return std::vector<byte>(digest.begin(), digest.end());
+	}
+	
 	// 'E' functions are the extended working size functions, so they'll have different outputs.
-	std::vector<byte> hashData128(std::vector<byte>& input) {
-		return NACHA::hash(input, 16, 5, 3);
+	// Each one also takes a string_view, a (pointer, length) bytespan, or an iovec array, hashed where it sits in memory.
+	// An iovec array gives the digest of its buffers joined end to end, without joining them.
+	inline std::vector<byte> hashData128(const std::vector<byte>& input) {
+		return toVector(Hash128::digest(input));
 	}
-	std::vector<byte> hashData128E(std::vector<byte>& input) {
-		return NACHA::hash(input, 16, 7, 4);
+	inline std::vector<byte> hashData128(std::string_view input) {return toVector(Hash128::digest(input));}
+	inline std::vector<byte> hashData128(bytespan input) {return toVector(Hash128::digest(input));}
+	inline std::vector<byte> hashData128(const struct iovec* parts, size_t count) {return toVector(Hash128::digest(parts, count));}
+	inline std::vector<byte> hashData128E(const std::vector<byte>& input) {
+		return toVector(Hash128E::digest(input));
 	}
+	inline std::vector<byte> hashData128E(std::string_view input) {return toVector(Hash128E::digest(input));}
+	inline std::vector<byte> hashData128E(bytespan input) {return toVector(Hash128E::digest(input));}
+	inline std::vector<byte> hashData128E(const struct iovec* parts, size_t count) {return toVector(Hash128E::digest(parts, count));}
 
-	std::vector<byte> hashData256(std::vector<byte>& input) {
-		return NACHA::hash(input, 32, 7, 4);
+	inline std::vector<byte> hashData256(const std::vector<byte>& input) {
+		return toVector(Hash256::digest(input));
 	}
-	std::vector<byte> hashData256E(std::vector<byte>& input) {
-		return NACHA::hash(input, 32, 9, 5);
+	inline std::vector<byte> hashData256(std::string_view input) {return toVector(Hash256::digest(input));}
+	inline std::vector<byte> hashData256(bytespan input) {return toVector(Hash256::digest(input));}
+	inline std::vector<byte> hashData256(const struct iovec* parts, size_t count) {return toVector(Hash256::digest(parts, count));}
+	inline std::vector<byte> hashData256E(const std::vector<byte>& input) {
+		return toVector(Hash256E::digest(input));
 	}
+	inline std::vector<byte> hashData256E(std::string_view input) {return toVector(Hash256E::digest(input));}
+	inline std::vector<byte> hashData256E(bytespan input) {return toVector(Hash256E::digest(input));}
+	inline std::vector<byte> hashData256E(const struct iovec* parts, size_t count) {return toVector(Hash256E::digest(parts, count));}
 	
-	std::vector<byte> hashData384(std::vector<byte>& input) {
-		return NACHA::hash(input, 48, 9, 5);
+	inline std::vector<byte> hashData384(const std::vector<byte>& input) {
+		return toVector(Hash384::digest(input));
 	}
-	std::vector<byte> hashData384E(std::vector<byte>& input) {
-		return NACHA::hash(input, 48, 11, 6);
+	inline std::vector<byte> hashData384(std::string_view input) {return toVector(Hash384::digest(input));}
+	inline std::vector<byte> hashData384(bytespan input) {return toVector(Hash384::digest(input));}
+	inline std::vector<byte> hashData384(const struct iovec* parts, size_t count) {return toVector(Hash384::digest(parts, count));}
+	inline std::vector<byte> hashData384E(const std::vector<byte>& input) {
+		return toVector(Hash384E::digest(input));
 	}
+	inline std::vector<byte> hashData384E(std::string_view input) {return toVector(Hash384E::digest(input));}
+	inline std::vector<byte> hashData384E(bytespan input) {return toVector(Hash384E::digest(input));}
+	inline std::vector<byte> hashData384E(const struct iovec* parts, size_t count) {return toVector(Hash384E::digest(parts, count));}
 	
-	std::vector<byte> hashData512(std::vector<byte>& input) {
-		return NACHA::hash(input, 64, 11, 6);
+	inline std::vector<byte> hashData512(const std::vector<byte>& input) {
+		return toVector(Hash512::digest(input));
 	}
-	std::vector<byte> hashData512E(std::vector<byte>& input) {
-		return NACHA::hash(input, 64, 13, 7);
+	inline std::vector<byte> hashData512(std::string_view input) {return toVector(Hash512::digest(input));}
+	inline std::vector<byte> hashData512(bytespan input) {return toVector(Hash512::digest(input));}
+	inline std::vector<byte> hashData512(const struct iovec* parts, size_t count) {return toVector(Hash512::digest(parts, count));}
+	inline std::vector<byte> hashData512E(const std::vector<byte>& input) {
+		return toVector(Hash512E::digest(input));
 	}
+	inline std::vector<byte> hashData512E(std::string_view input) {return toVector(Hash512E::digest(input));}
+	inline std::vector<byte> hashData512E(bytespan input) {return toVector(Hash512E::digest(input));}
+	inline std::vector<byte> hashData512E(const struct iovec* parts, size_t count) {return toVector(Hash512E::digest(parts, count));}
 	
-	std::vector<byte> hashData768(std::vector<byte>& input) {
-		return NACHA::hash(input, 96, 13, 7);
+	inline std::vector<byte> hashData768(const std::vector<byte>& input) {
+		return toVector(Hash768::digest(input));
+	}
+	inline std::vector<byte> hashData768(std::string_view input) {return toVector(Hash768::digest(input));}
+	inline std::vector<byte> hashData768(bytespan input) {return toVector(Hash768::digest(input));}
+	inline std::vector<byte> hashData768(const struct iovec* parts, size_t count) {return toVector(Hash768::digest(parts, count));}
+	inline std::vector<byte> hashData768E(const std::vector<byte>& input) {
+		return toVector(Hash768E::digest(input));
 	}
-	std::vector<byte> hashData768E(std::vector<byte>& input) {
-		return NACHA::hash(input, 96, 15, 8);
+	inline std::vector<byte> hashData768E(std::string_view input) {return toVector(Hash768E::digest(input));}
+	inline std::vector<byte> hashData768E(bytespan input) {return toVector(Hash768E::digest(input));}
+	inline std::vector<byte> hashData768E(const struct iovec* parts, size_t count) {return toVector(Hash768E::digest(parts, count));}
+	
+	//! Hashes every message in \c input as hashData256 would, placing digest \c i at <CODE>out[i * 32]</CODE>
+	inline void hashBatch256(const std::vector<bytespan>& input, std::vector<byte>& out) {
+		out.resize(input.size() * 32);
+		NACHA::hashBatch(input.data(), input.size(), out.data(), 32, 7, 4);
+	}
+	
+	//! NACHA Tree digest with the hashData256 parameters; a different value from hashData256 itself
+	inline std::vector<byte> hashTree256(const std::vector<byte>& input, uint workers = 1) {
+		return NACHA::treeHash(input.data(), input.size(), 32, 7, 4, 16384, workers);
 	}
 	
-	//! Convert a classic character string to a usable byte vector.
-	const std::vector<byte> strToBVec(std::string in) {
-		std::vector<byte> N;
-		for (char  i : in) {
-			N.push_back( byte(i) );
-		}
-		return N;
+	//! Convert a classic character string to a usable byte vector, in one allocation.
+	inline std::vector<byte> strToBVec(std::string_view in) {
+		return std::vector<byte>(in.begin(), in.end());
 	}
 	
-	const std::string bvecToStr(const bytevec N) {
-		std::string J = "";
-		for (byte i : N) {
-			J += char( i );
-		}
-		return J;
+	inline std::string bvecToStr(const bytevec& N) {
+		return std::string(N.begin(), N.end());
 	}
 }
 
@@ -0,0 +1,225 @@
+/*
+ * nacha-cache.cpp  --> Persistent file digest cache for nacha-file.hpp
+ * 
+ * Copyright (c) August 2021 Evan R. Clegern <evanclegern.work@gmail.com>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "nacha-cache.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ERCLIB {
+namespace NACHA {
+	namespace {
+		const char cacheMagic[8] = {'N','A','C','H','A','C','H','E'};
+		const uint32_t cacheVersion = 1;
+		
+		struct Header {
+			char magic[8];
+			uint32_t version, recordSize;
+			uint64_t count, unused;
+		};
+		static_assert(sizeof(Header) == 32, "cache header layout");
+		static_assert(sizeof(DigestCache::Record) == 136, "cache record layout");
+		
+		typedef DigestCache::Record Record;
+		
+		//! Records are ordered by identity: the inode and the parameter set, not the file's version
+		bool before(const Record& a, const Record& b) {
+			if (a.device != b.device) return a.device < b.device;
+			if (a.inode != b.inode) return a.inode < b.inode;
+			if (a.capac != b.capac) return a.capac < b.capac;
+			if (a.blkA != b.blkA) return a.blkA < b.blkA;
+			if (a.blkB != b.blkB) return a.blkB < b.blkB;
+			return a.mode < b.mode;
+		}
+		
+		Record keyOf(const FileStamp& stamp, const Variant& v, bool tree) {
+			Record r;
+			std::memset(&r, 0, sizeof(r));
+			r.device = stamp.device; r.inode = stamp.inode; r.size = stamp.size; r.mtimeNs = stamp.mtimeNs;
+			r.capac = v.capac; r.blkA = v.blkA; r.blkB = v.blkB; r.mode = tree ? 1 : 0;
+			return r;
+		}
+		
+		std::runtime_error cacheError(const std::string& what, const std::string& path) {
+			return std::runtime_error("NACHA cache " + path + ": " + what + ": " + std::strerror(errno));
+		}
+		
+		void writeAll(int fd, const void* src, size_t len, const std::string& path) {
+			const char* p = static_cast<const char*>(src);
+			while (len > 0) {
+				const ssize_t put = ::write(fd, p, len);
+				if (put < 0) {
+					if (errno == EINTR) continue;
+					throw cacheError("cannot write", path);
+				}
+				p += put; len -= size_t(put);
+			}
+		}
+		
+		//! flock() on a side file, since the cache file itself is replaced on every flush
+		class FileLock {
+			int fd;
+		public:
+			explicit FileLock(const std::string& path) {
+				this->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+				if (this->fd < 0) throw cacheError("cannot open lock", path);
+				while (::flock(this->fd, LOCK_EX) != 0) {
+					if (errno == EINTR) continue;
+					const std::runtime_error e = cacheError("cannot lock", path);
+					::close(this->fd);
+					throw e;
+				}
+			}
+			~FileLock() {::close(this->fd);}
+		};
+	}
+	
+	DigestCache::DigestCache(const std::string& _path) : path(_path), records(nullptr), count(0), mapped(0) {
+		this->map();
+	}
+	DigestCache::~DigestCache() {
+		this->unmap();
+	}
+	
+	//! Maps the cache file as it is now; a missing, empty or foreign file reads as an empty cache
+	void DigestCache::map() {
+		const int fd = ::open(this->path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			if (errno == ENOENT) return;
+			throw cacheError("cannot open", this->path);
+		}
+		struct stat st;
+		if (::fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+			::close(fd);
+			return;
+		}
+		void* base = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (base == MAP_FAILED) throw cacheError("cannot map", this->path);
+		const Header* H = static_cast<const Header*>(base);
+		if (std::memcmp(H->magic, cacheMagic, 8) != 0 || H->version != cacheVersion || H->recordSize != sizeof(Record) || H->count > (size_t(st.st_size) - sizeof(Header)) / sizeof(Record)) {
+			::munmap(base, size_t(st.st_size));
+			return;
+		}
+		this->mapped = size_t(st.st_size);
+		this->records = reinterpret_cast<const Record*>(H + 1);
+		this->count = size_t(H->count);
+	}
+	void DigestCache::unmap() {
+		if (this->records) ::munmap(const_cast<Header*>(reinterpret_cast<const Header*>(this->records) - 1), this->mapped);
+		this->records = nullptr;
+		this->count = this->mapped = 0;
+	}
+	
+	bool DigestCache::Before::operator()(const Record& a, const Record& b) const noexcept {
+		return before(a, b);
+	}
+	
+	bool DigestCache::lookup(const FileStamp& stamp, const Variant& v, bool tree, std::vector<byte>& out) const {
+		const Record key = keyOf(stamp, v, tree);
+		{
+			std::lock_guard<std::mutex> L(this->queueLock);
+			const auto queued = this->queue.find(key);
+			if (queued != this->queue.end() && queued->size == key.size && queued->mtimeNs == key.mtimeNs) {
+				out.assign(queued->digest, queued->digest + v.capac);
+				return true;
+			}
+		}
+		const Record* end = this->records + this->count;
+		const Record* hit = std::lower_bound(this->records, end, key, before);
+		if (hit == end || before(key, *hit)) return false;
+		if (hit->size != key.size || hit->mtimeNs != key.mtimeNs) return false;
+		out.assign(hit->digest, hit->digest + v.capac);
+		return true;
+	}
+	void DigestCache::insert(const FileStamp& stamp, const Variant& v, bool tree, const std::vector<byte>& digest) {
+		if (digest.size() != v.capac || v.capac > maxDigest) return; //only the hashData sizes fit a record
+		Record r = keyOf(stamp, v, tree);
+		std::copy(digest.begin(), digest.end(), r.digest);
+		std::lock_guard<std::mutex> L(this->queueLock);
+		const auto queued = this->queue.find(r);
+		if (queued != this->queue.end()) this->queue.erase(queued); //a later insert of the same identity wins
+		this->queue.insert(r);
+	}
+	size_t DigestCache::pending() const {
+		std::lock_guard<std::mutex> L(this->queueLock);
+		return this->queue.size();
+	}
+	
+	/********!
+	 * @brief
+	 * 			Writes every queued digest to the cache file and remaps it.
+	 * 
+	 * @details
+	 * 			Under the lock, the file is mapped afresh so records other
+	 * 			processes flushed since we opened it are kept. Queued
+	 * 			records win over mapped ones, and later ones over earlier.
+	 ********/
+	void DigestCache::flush() {
+		std::lock_guard<std::mutex> Q(this->queueLock);
+		if (this->queue.empty()) return;
+		FileLock L(this->path + ".lock");
+		this->unmap();
+		this->map();
+		
+		std::vector<Record> merged;
+		merged.reserve(this->count + this->queue.size());
+		const Record *A = this->records, *AEnd = this->records + this->count;
+		for (const Record& q : this->queue) {
+			while (A != AEnd && before(*A, q)) merged.push_back(*A++);
+			if (A != AEnd && !before(q, *A)) A++;
+			merged.push_back(q);
+		}
+		merged.insert(merged.end(), A, AEnd);
+		
+		Header H;
+		std::memcpy(H.magic, cacheMagic, 8);
+		H.version = cacheVersion;
+		H.recordSize = sizeof(Record);
+		H.count = merged.size();
+		H.unused = 0;
+		std::string temp = this->path + ".XXXXXX";
+		const int fd = ::mkstemp(&temp[0]);
+		if (fd < 0) throw cacheError("cannot create", temp);
+		try {
+			writeAll(fd, &H, sizeof(H), temp);
+			writeAll(fd, merged.data(), merged.size() * sizeof(Record), temp);
+			if (::fchmod(fd, 0644) != 0 || ::fsync(fd) != 0) throw cacheError("cannot sync", temp);
+		} catch (...) {
+			::close(fd);
+			::unlink(temp.c_str());
+			throw;
+		}
+		::close(fd);
+		if (::rename(temp.c_str(), this->path.c_str()) != 0) {
+			const std::runtime_error e = cacheError("cannot replace", this->path);
+			::unlink(temp.c_str());
+			throw e;
+		}
+		this->queue.clear();
+		this->unmap();
+		this->map();
+	}
+}
+}
@@ -0,0 +1,75 @@
+#ifndef erclib_nacha_cache_included
+#define erclib_nacha_cache_included
+
+#include "nacha-file.hpp"
+#include <mutex>
+#include <set>
+
+namespace ERCLIB {
+namespace NACHA {
+	/********!
+	 * @brief
+	 * 			On-disk cache of file digests, keyed by device, inode, size,
+	 * 			mtime (in nanoseconds) and the digest's parameters.
+	 * 
+	 * @details
+	 * 			The file is a 32-byte header and a sorted array of fixed
+	 * 			136-byte records, one per (inode, parameters) pair, which
+	 * 			is memory-mapped and binary searched; nothing is parsed on
+	 * 			open. Any number of processes may read one cache at once.
+	 * 
+	 * 			\c insert() only queues a digest, in a set ordered like the
+	 * 			file, so lookups stay logarithmic however much is queued.
+	 * 			\c flush() takes an exclusive lock on <CODE>path.lock</CODE>,
+	 * 			merges the queue into the current file and renames a new
+	 * 			file over it, so readers never see a half-written cache. A
+	 * 			newer record for an inode replaces the older one, keeping
+	 * 			the cache to one record per inode and parameter set.
+	 * 
+	 * @note
+	 * 			Records are native-endian, since inode numbers only mean
+	 * 			anything on the machine that wrote them.
+	 ********/
+	class DigestCache {
+	public:
+		static constexpr size_t maxDigest = 96; //the largest hashData digest, 768E
+		
+		explicit DigestCache(const std::string& path);
+		~DigestCache();
+		DigestCache(const DigestCache&) = delete;
+		DigestCache& operator=(const DigestCache&) = delete;
+		
+		//! Both are safe to call from several threads, but not alongside flush()
+		bool lookup(const FileStamp& stamp, const Variant& v, bool tree, std::vector<byte>& out) const;
+		void insert(const FileStamp& stamp, const Variant& v, bool tree, const std::vector<byte>& digest);
+		void flush();
+		
+		size_t size() const noexcept {return this->count;};
+		size_t pending() const;
+		
+		struct Record {
+			uint64_t device, inode, size;
+			int64_t mtimeNs;
+			ushort capac;
+			byte blkA, blkB, mode, unused[3];
+			byte digest[maxDigest];
+		};
+	private:
+		//! Orders records as the file does, by identity
+		struct Before {
+			bool operator()(const Record& a, const Record& b) const noexcept;
+		};
+		
+		std::string path;
+		const Record* records;
+		size_t count, mapped;
+		mutable std::mutex queueLock;
+		std::set<Record, Before> queue;
+		
+		void map();
+		void unmap();
+	};
+}
+}
+
+#endif
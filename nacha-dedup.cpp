@@ -0,0 +1,370 @@
+/*
+ * nacha-dedup.cpp  --> Content-defined chunking and chunk index for nacha-dedup.hpp
+ *
+ * Copyright (c) August 2021 Evan R. Clegern <evanclegern.work@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "nacha-dedup.hpp"
+#include "bytes.hpp"
+#include "threading.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ERCLIB {
+namespace NACHA {
+	namespace {
+		//! 256 fixed random words for the gear hash, from a SplitMix64 sequence
+		struct GearTable {
+			uint64_t v[256];
+		};
+		constexpr GearTable buildGearTable() {
+			GearTable T{};
+			uint64_t s = 0x4E41434841434443ULL; //"NACHACDC"
+			for (int i = 0; i < 256; i++) {
+				s += 0x9E3779B97F4A7C15ULL;
+				uint64_t z = s;
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+				T.v[i] = z ^ (z >> 31);
+			}
+			return T;
+		}
+		constexpr GearTable gearTable = buildGearTable();
+
+		//! Bytes read from a stream between fingerprinting rounds
+		const size_t chunkBatch = size_t(8) << 20;
+
+		void checkParams(const ChunkParams& P) {
+			if (P.minSize < 64 || P.minSize >= P.avgSize || P.avgSize >= P.maxSize) throw std::invalid_argument("NACHA chunk sizes must satisfy 64 <= min < average < max!");
+			if (P.maxSize > ChunkParams::maxChunkLimit) throw std::invalid_argument("NACHA chunks cannot be longer than ChunkParams::maxChunkLimit!");
+		}
+		//! A mask of the top \c bits bits; the gear hash's newest bytes reach the top last
+		inline uint64_t topMask(uint bits) {
+			return ~uint64_t(0) << (64 - bits);
+		}
+
+		//! Fingerprints \c chunks (offsets relative to \c data) on up to \c workers threads
+		void fingerprintAll(const byte* data, uint64_t base, std::vector<Chunk>& chunks, uint workers) {
+			Threading::forRange(chunks.size(), workers, [&](size_t first, size_t last, uint) {
+				for (size_t i = first; i < last; i++) chunks[i].fingerprint = fingerprint(data + (chunks[i].offset - base), chunks[i].length);
+			});
+		}
+	}
+
+	/********!
+	 * @brief
+	 * 			FastCDC-style cut point search, with a gear hash that
+	 * 			shifts left one bit a byte.
+	 *
+	 * @details
+	 * 			The first \c minSize bytes are skipped outright. Up to
+	 * 			\c avgSize, a cut needs one more zero bit than the average
+	 * 			calls for; past it, one fewer.
+	 ********/
+	size_t findCut(const byte* data, size_t len, const ChunkParams& params) {
+		if (len <= params.minSize) return len;
+		const size_t end = std::min(len, params.maxSize), normal = std::min(end, params.avgSize);
+		uint bits = 0;
+		while ((size_t(2) << bits) <= params.avgSize) bits++;
+		const uint64_t maskS = topMask(bits + 1), maskL = topMask(bits - 1);
+		uint64_t fp = 0;
+		size_t i = params.minSize;
+		for (; i < normal; i++) {
+			fp = (fp << 1) + gearTable.v[data[i]];
+			if (!(fp & maskS)) return i + 1;
+		}
+		for (; i < end; i++) {
+			fp = (fp << 1) + gearTable.v[data[i]];
+			if (!(fp & maskL)) return i + 1;
+		}
+		return end;
+	}
+
+	//! The hashData256 digest of one chunk; each thread keeps its own arena
+	Fingerprint fingerprint(const byte* data, size_t len) {
+		return Hasher<32, 7, 4>::digest(data, len);
+	}
+
+	//! Splits a whole buffer, fingerprinting the chunks on up to \c workers threads
+	std::vector<Chunk> chunkData(const byte* data, size_t len, const ChunkParams& params, uint workers) {
+		checkParams(params);
+		std::vector<Chunk> chunks;
+		for (size_t at = 0; at < len;) {
+			const size_t n = findCut(data + at, len - at, params);
+			chunks.push_back({at, uint32_t(n), {}});
+			at += n;
+		}
+		fingerprintAll(data, 0, chunks, workers);
+		return chunks;
+	}
+
+	/********!
+	 * @brief
+	 * 			Chunks everything read from \c fd, until end of file.
+	 *
+	 * @details
+	 * 			Reads in 8MB batches. Each batch is cut, its chunks are
+	 * 			fingerprinted on up to \c workers threads, and then they
+	 * 			are handed to \c emit in order. The tail that might still
+	 * 			grow is carried over to the next batch. Pipes and sockets
+	 * 			work as well as files.
+	 ********/
+	void chunkFd(int fd, const ChunkSink& emit, const ChunkParams& params, uint workers) {
+		checkParams(params);
+		std::vector<byte> buf(chunkBatch + params.maxSize);
+		std::vector<Chunk> chunks;
+		size_t have = 0;
+		uint64_t base = 0;
+		bool eof = false;
+		while (true) {
+			while (!eof && have < buf.size()) {
+				const ssize_t got = ::read(fd, buf.data() + have, buf.size() - have);
+				if (got < 0) {
+					if (errno == EINTR) continue;
+					throw std::runtime_error(std::string("NACHA could not read a stream to chunk: ") + std::strerror(errno));
+				}
+				if (got == 0) eof = true;
+				have += size_t(got);
+			}
+			chunks.clear();
+			size_t at = 0;
+			while (at < have && (eof || have - at >= params.maxSize)) {
+				const size_t n = findCut(buf.data() + at, have - at, params);
+				chunks.push_back({base + at, uint32_t(n), {}});
+				at += n;
+			}
+			fingerprintAll(buf.data(), base, chunks, workers);
+			for (const Chunk& c : chunks) emit(c, buf.data() + (c.offset - base));
+
+			std::memmove(buf.data(), buf.data() + at, have - at);
+			base += at;
+			have -= at;
+			if (eof && have == 0) break;
+		}
+	}
+
+	namespace {
+		const char indexMagic[8] = {'N','A','C','H','A','I','D','X'};
+		const uint32_t indexVersion = 1;
+
+		struct IndexHeader {
+			char magic[8];
+			uint32_t version, recordSize;
+			uint64_t slots, count;
+			byte unused[32];
+		};
+		static_assert(sizeof(IndexHeader) == 64, "chunk index header layout");
+		static_assert(sizeof(ChunkIndex::Record) == 48, "chunk index record layout");
+
+		typedef ChunkIndex::Record Record;
+
+		std::runtime_error indexError(const std::string& what, const std::string& path) {
+			return std::runtime_error("NACHA chunk index " + path + ": " + what + ": " + std::strerror(errno));
+		}
+		//! Home slot of a fingerprint; NACHA digests are not uniform, so all four words are mixed
+		inline uint64_t slotOf(const byte* fp) {
+			uint64_t h = 0;
+			for (size_t w = 0; w < fingerprintSize; w += 8) {
+				uint64_t x;
+				std::memcpy(&x, fp + w, 8);
+				h = Bytes::fmix64(h ^ x);
+			}
+			return h;
+		}
+		inline size_t fileSize(uint64_t slots) {
+			return sizeof(IndexHeader) + (size_t(slots) * sizeof(Record));
+		}
+		void lockFd(int fd, int how, const std::string& path) {
+			while (::flock(fd, how) != 0) {
+				if (errno == EINTR) continue;
+				throw indexError("cannot lock", path);
+			}
+		}
+		//! Places \c r at its first free slot; the caller makes sure there is one
+		void place(Record* R, uint64_t slots, const Record& r) {
+			for (uint64_t i = slotOf(r.fingerprint) & (slots - 1);; i = (i + 1) & (slots - 1)) {
+				if (R[i].refs == 0) {
+					R[i] = r;
+					return;
+				}
+			}
+		}
+	}
+
+	ChunkIndex::ChunkIndex(const std::string& _path, bool _writable, uint64_t initialSlots) : path(_path), writable(_writable), fd(-1), base(nullptr), mapped(0) {
+		this->open(initialSlots);
+	}
+	ChunkIndex::~ChunkIndex() {
+		this->unmap();
+		if (this->fd >= 0) ::close(this->fd);
+	}
+
+	//! Opens and locks the index file, creating it if writable; waits out anyone else's rebuild
+	void ChunkIndex::open(uint64_t initialSlots) {
+		while (true) {
+			this->fd = ::open(this->path.c_str(), (this->writable ? (O_RDWR | O_CREAT) : O_RDONLY) | O_CLOEXEC, 0644);
+			if (this->fd < 0) {
+				if (!this->writable && errno == ENOENT) return; //reads as empty
+				throw indexError("cannot open", this->path);
+			}
+			lockFd(this->fd, this->writable ? LOCK_EX : LOCK_SH, this->path);
+			// A writer may have renamed a rebuilt table over the file while we waited for the lock
+			struct stat held, named;
+			if (::fstat(this->fd, &held) == 0 && ::stat(this->path.c_str(), &named) == 0 && held.st_ino == named.st_ino && held.st_dev == named.st_dev) break;
+			::close(this->fd);
+			this->fd = -1;
+		}
+		struct stat st;
+		if (::fstat(this->fd, &st) != 0) throw indexError("cannot stat", this->path);
+		if (st.st_size == 0 && this->writable) {
+			uint64_t slots = 16;
+			while (slots < initialSlots) slots *= 2;
+			IndexHeader H;
+			std::memset(&H, 0, sizeof(H));
+			std::memcpy(H.magic, indexMagic, 8);
+			H.version = indexVersion;
+			H.recordSize = sizeof(Record);
+			H.slots = slots;
+			if (::ftruncate(this->fd, off_t(fileSize(slots))) != 0 || ::pwrite(this->fd, &H, sizeof(H), 0) != ssize_t(sizeof(H))) throw indexError("cannot create", this->path);
+		}
+		this->map();
+	}
+	void ChunkIndex::map() {
+		struct stat st;
+		if (::fstat(this->fd, &st) != 0) throw indexError("cannot stat", this->path);
+		if (size_t(st.st_size) < sizeof(IndexHeader)) throw std::runtime_error("NACHA chunk index " + this->path + " is not a chunk index");
+		void* at = ::mmap(nullptr, size_t(st.st_size), PROT_READ | (this->writable ? PROT_WRITE : 0), MAP_SHARED, this->fd, 0);
+		if (at == MAP_FAILED) throw indexError("cannot map", this->path);
+		const IndexHeader* H = static_cast<const IndexHeader*>(at);
+		if (std::memcmp(H->magic, indexMagic, 8) != 0 || H->version != indexVersion || H->recordSize != sizeof(Record) || H->slots < 16 || (H->slots & (H->slots - 1)) || fileSize(H->slots) != size_t(st.st_size)) {
+			::munmap(at, size_t(st.st_size));
+			throw std::runtime_error("NACHA chunk index " + this->path + " is not a chunk index, or is damaged");
+		}
+		this->base = static_cast<byte*>(at);
+		this->mapped = size_t(st.st_size);
+	}
+	void ChunkIndex::unmap() {
+		if (this->base) ::munmap(this->base, this->mapped);
+		this->base = nullptr;
+		this->mapped = 0;
+	}
+
+	bool ChunkIndex::lookup(const Fingerprint& fp, Record& out) const {
+		std::lock_guard<std::mutex> L(this->lock);
+		if (!this->base) return false;
+		const IndexHeader* H = reinterpret_cast<const IndexHeader*>(this->base);
+		const Record* R = reinterpret_cast<const Record*>(H + 1);
+		const uint64_t mask = H->slots - 1;
+		for (uint64_t i = slotOf(fp.data()) & mask;; i = (i + 1) & mask) {
+			if (R[i].refs == 0) return false;
+			if (std::memcmp(R[i].fingerprint, fp.data(), fingerprintSize) == 0) {
+				out = R[i];
+				return true;
+			}
+		}
+	}
+	bool ChunkIndex::insert(const Fingerprint& fp, uint64_t location, uint32_t length) {
+		if (!this->writable) throw std::runtime_error("NACHA chunk index " + this->path + " was opened read-only");
+		std::lock_guard<std::mutex> L(this->lock);
+		IndexHeader* H = reinterpret_cast<IndexHeader*>(this->base);
+		if ((H->count + 1) * 4 > H->slots * 3) {
+			this->grow();
+			H = reinterpret_cast<IndexHeader*>(this->base);
+		}
+		Record* R = reinterpret_cast<Record*>(H + 1);
+		const uint64_t mask = H->slots - 1;
+		for (uint64_t i = slotOf(fp.data()) & mask;; i = (i + 1) & mask) {
+			if (R[i].refs == 0) {
+				std::memcpy(R[i].fingerprint, fp.data(), fingerprintSize);
+				R[i].location = location;
+				R[i].length = length;
+				R[i].refs = 1; //marks the slot used
+				H->count++;
+				return true;
+			}
+			if (std::memcmp(R[i].fingerprint, fp.data(), fingerprintSize) == 0) {
+				if (R[i].refs != UINT32_MAX) R[i].refs++;
+				return false;
+			}
+		}
+	}
+
+	/********!
+	 * @brief
+	 * 			Rebuilds the table at twice the size, under the lock we
+	 * 			already hold.
+	 *
+	 * @details
+	 * 			The new table is written to a temporary file, which is
+	 * 			locked before it is renamed into place. So the new file
+	 * 			is never seen unlocked. Processes still waiting on the old
+	 * 			file notice the rename once they get its lock, and reopen.
+	 ********/
+	void ChunkIndex::grow() {
+		const IndexHeader* H = reinterpret_cast<const IndexHeader*>(this->base);
+		const Record* R = reinterpret_cast<const Record*>(H + 1);
+		const uint64_t slots = H->slots * 2;
+
+		std::string temp = this->path + ".XXXXXX";
+		const int tfd = ::mkstemp(&temp[0]);
+		if (tfd < 0) throw indexError("cannot create", temp);
+		void* at = MAP_FAILED;
+		try {
+			lockFd(tfd, LOCK_EX, temp);
+			if (::fchmod(tfd, 0644) != 0 || ::ftruncate(tfd, off_t(fileSize(slots))) != 0) throw indexError("cannot size", temp);
+			at = ::mmap(nullptr, fileSize(slots), PROT_READ | PROT_WRITE, MAP_SHARED, tfd, 0);
+			if (at == MAP_FAILED) throw indexError("cannot map", temp);
+			IndexHeader* N = static_cast<IndexHeader*>(at);
+			*N = *H;
+			N->slots = slots;
+			Record* NR = reinterpret_cast<Record*>(N + 1);
+			for (uint64_t i = 0; i < H->slots; i++) if (R[i].refs) place(NR, slots, R[i]);
+			if (::msync(at, fileSize(slots), MS_SYNC) != 0) throw indexError("cannot sync", temp);
+			::munmap(at, fileSize(slots));
+			at = MAP_FAILED;
+			if (::rename(temp.c_str(), this->path.c_str()) != 0) throw indexError("cannot replace", this->path);
+		} catch (...) {
+			if (at != MAP_FAILED) ::munmap(at, fileSize(slots));
+			::close(tfd);
+			::unlink(temp.c_str());
+			throw;
+		}
+		this->unmap();
+		::close(this->fd);
+		this->fd = tfd;
+		this->map();
+	}
+
+	void ChunkIndex::sync() {
+		std::lock_guard<std::mutex> L(this->lock);
+		if (this->base && this->writable && ::msync(this->base, this->mapped, MS_SYNC) != 0) throw indexError("cannot sync", this->path);
+	}
+	uint64_t ChunkIndex::size() const {
+		std::lock_guard<std::mutex> L(this->lock);
+		return this->base ? reinterpret_cast<const IndexHeader*>(this->base)->count : 0;
+	}
+	uint64_t ChunkIndex::slots() const {
+		std::lock_guard<std::mutex> L(this->lock);
+		return this->base ? reinterpret_cast<const IndexHeader*>(this->base)->slots : 0;
+	}
+}
+}
@@ -0,0 +1,112 @@
+#ifndef erclib_nacha_dedup_included
+#define erclib_nacha_dedup_included
+
+#include "nacha.hpp"
+#include <cstdint>
+#include <mutex>
+
+namespace ERCLIB {
+namespace NACHA {
+	//! Fingerprints are hashData256 digests
+	constexpr size_t fingerprintSize = 32;
+	typedef std::array<byte, fingerprintSize> Fingerprint;
+
+	/********!
+	 * @brief
+	 * 			Sizes for content-defined chunking. Cuts fall where a gear
+	 * 			hash over the last 64 bytes matches a mask, so an edit only
+	 * 			moves the cuts near it.
+	 *
+	 * @details
+	 * 			No chunk is shorter than \c minSize (except the last one of
+	 * 			a stream) or longer than \c maxSize. Cuts are harder to find
+	 * 			before \c avgSize and easier after it, which keeps most
+	 * 			chunks close to the average.
+	 *
+	 * @note
+	 * 			\c maxSize can be at most \c maxChunkLimit; hashData256
+	 * 			throws for many lengths past about 46KB.
+	 ********/
+	struct ChunkParams {
+		static constexpr size_t maxChunkLimit = 32768;
+		size_t minSize = 2048, avgSize = 8192, maxSize = 32768;
+	};
+
+	//! One chunk of a stream: where it starts, how long it is and its fingerprint
+	struct Chunk {
+		uint64_t offset;
+		uint32_t length;
+		Fingerprint fingerprint;
+	};
+
+	//! Length of the chunk at the front of \c data; needs \c maxSize bytes in hand unless \c data runs to the end of the stream
+	extern size_t findCut(const byte* data, size_t len, const ChunkParams& params);
+	extern Fingerprint fingerprint(const byte* data, size_t len);
+
+	extern std::vector<Chunk> chunkData(const byte* data, size_t len, const ChunkParams& params = ChunkParams(), uint workers = 1);
+	//! \c emit gets each chunk, in order, with its bytes; they are only valid during the call
+	typedef std::function<void(const Chunk& chunk, const byte* data)> ChunkSink;
+	extern void chunkFd(int fd, const ChunkSink& emit, const ChunkParams& params = ChunkParams(), uint workers = 1);
+
+	/********!
+	 * @brief
+	 * 			Memory-mapped hash table from chunk fingerprints to where
+	 * 			each chunk is stored, for a deduplicating store.
+	 *
+	 * @details
+	 * 			The file is a 64-byte header and a power-of-two array of
+	 * 			48-byte records, probed linearly from a mix of the
+	 * 			fingerprint. Lookups and inserts touch a record or two
+	 * 			in place. Nothing is read up front, so opening costs the
+	 * 			same for a thousand chunks or a few billion.
+	 *
+	 * 			Once three quarters full, the table is rebuilt at twice the
+	 * 			size into a new file that is renamed over the old one.
+	 *
+	 * 			A writable index holds an exclusive flock() on its file, and
+	 * 			a read-only one a shared lock. So one process writes at a
+	 * 			time, while any number read when nobody is writing. Within a
+	 * 			process, all calls are serialised.
+	 *
+	 * @note
+	 * 			A record's reference count is written last and marks it as
+	 * 			used. Call \c sync() to push inserts to disk; anything
+	 * 			inserted since the last sync may be lost in a crash.
+	 ********/
+	class ChunkIndex {
+	public:
+		struct Record {
+			byte fingerprint[fingerprintSize];
+			uint64_t location; //where the caller stored the chunk, e.g. an offset into a pack file
+			uint32_t length, refs; //refs is zero only in an empty slot
+		};
+
+		explicit ChunkIndex(const std::string& path, bool writable = true, uint64_t initialSlots = 65536);
+		~ChunkIndex();
+		ChunkIndex(const ChunkIndex&) = delete;
+		ChunkIndex& operator=(const ChunkIndex&) = delete;
+
+		bool lookup(const Fingerprint& fp, Record& out) const;
+		//! Adds a chunk, returning true; a fingerprint already present only has its count raised, and returns false
+		bool insert(const Fingerprint& fp, uint64_t location, uint32_t length);
+		void sync();
+
+		uint64_t size() const;
+		uint64_t slots() const;
+	private:
+		std::string path;
+		bool writable;
+		int fd;
+		byte* base;
+		size_t mapped;
+		mutable std::mutex lock;
+
+		void open(uint64_t initialSlots);
+		void map();
+		void unmap();
+		void grow();
+	};
+}
+}
+
+#endif
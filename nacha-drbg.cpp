@@ -0,0 +1,129 @@
+/*
+ * nacha-drbg.cpp  --> Deterministic random bit generator for nacha-drbg.hpp
+ *
+ * Copyright (c) August 2021 Evan R. Clegern <evanclegern.work@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "nacha-drbg.hpp"
+#include "bytes.hpp"
+#include "threading.hpp"
+#include <algorithm>
+#include <cstring>
+#include <exception>
+
+namespace ERCLIB {
+namespace NACHA {
+	namespace {
+		//! Every digest here is NACHA-L with the 512 block sizes; only the capacity changes
+		const byte drbgBlkA = 11, drbgBlkB = 6;
+		const byte seedTag = 0x00, reseedTag = 0x01, blockTag = 0x02, updateTag = 0x03;
+		//! An output block's input: its tag, the key and the counter
+		const size_t blockInput = 1 + 64 + 8;
+
+		//! Writes \c len as eight little-endian bytes at \c dst, then the bytes themselves; returns the end
+		byte* putField(byte* dst, const byte* src, size_t len) {
+			Bytes::putLE(dst, len, 8);
+			if (len) std::memcpy(dst + 8, src, len);
+			return dst + 8 + len;
+		}
+	}
+
+	DRBG::~DRBG() {
+		Bytes::wipe(this->key.data(), this->key.size()); //basic memory sanitation
+		Bytes::wipe(&this->counter, sizeof(this->counter));
+	}
+
+	//! Replaces the key with a 64-byte digest of the tag, the old key if \c keepKey, the two fields and the counter
+	void DRBG::rekey(byte tag, const byte* a, size_t aLen, const byte* b, size_t bLen, bool keepKey) {
+		const size_t keyLen = keepKey ? this->key.size() : 0;
+		std::vector<byte> msg(1 + keyLen + 8 + aLen + 8 + bLen + 8);
+		byte* at = msg.data();
+		*at++ = tag;
+		if (keyLen) std::memcpy(at, this->key.data(), keyLen);
+		at = putField(at + keyLen, a, aLen);
+		at = putField(at, b, bLen);
+		Bytes::putLE(at, this->counter, 8);
+		hashL(msg.data(), msg.size(), this->key.data(), ushort(this->key.size()), drbgBlkA, drbgBlkB);
+		Bytes::wipe(msg.data(), msg.size()); //basic memory sanitation
+	}
+
+	//! Starts over from \c entropy and an optional personalization string, discarding any earlier state
+	void DRBG::seed(const byte* entropy, size_t entropyLen, const byte* personal, size_t personalLen) {
+		this->counter = 0;
+		this->rekey(seedTag, entropy, entropyLen, personal, personalLen, false);
+		this->seeded = true;
+	}
+	//! Mixes fresh \c entropy (and optional additional input) into the current state
+	void DRBG::reseed(const byte* entropy, size_t entropyLen, const byte* additional, size_t additionalLen) {
+		if (!this->seeded) throw std::runtime_error("NACHA DRBG must be seeded before it can be reseeded!");
+		this->rekey(reseedTag, entropy, entropyLen, additional, additionalLen, true);
+	}
+
+	/********!
+	 * @brief
+	 * 			Writes \c len pseudo-random bytes to \c out, on up to
+	 * 			\c workers threads.
+	 *
+	 * @details
+	 * 			Each thread takes a contiguous run of blocks, with its own
+	 * 			arena, and hashes whole blocks directly into \c out; only a
+	 * 			final partial block goes through a temporary.
+	 *
+	 * @exception std::runtime_error
+	 * 			If the generator has not been seeded.
+	 ********/
+	void DRBG::generate(byte* out, size_t len, uint workers) {
+		if (!this->seeded) throw std::runtime_error("NACHA DRBG must be seeded before it can generate!");
+		const size_t blocks = (len + blockSize - 1) / blockSize;
+		const HashPlan plan(blockInput, blockSize, drbgBlkA, drbgBlkB, 1, true);
+		const uint64_t base = this->counter;
+		std::vector<std::exception_ptr> failed(std::max(workers, 1u));
+		Threading::forRange(blocks, workers, [&](size_t first, size_t last, uint t) {
+			byte msg[blockInput], tail[blockSize];
+			std::vector<byte> arena;
+			try {
+				msg[0] = blockTag;
+				std::copy(this->key.begin(), this->key.end(), msg + 1);
+				for (size_t i = first; i < last; i++) {
+					Bytes::putLE(msg + 1 + this->key.size(), base + i, 8);
+					byte* dst = out + (i * blockSize);
+					if (len - (i * blockSize) >= blockSize) {
+						hash(plan, msg, arena, dst);
+					} else {
+						hash(plan, msg, arena, tail);
+						std::memcpy(dst, tail, len - (i * blockSize));
+					}
+				}
+			} catch (...) {
+				failed[t] = std::current_exception();
+			}
+			Bytes::wipe(msg, blockInput); //basic memory sanitation
+			Bytes::wipe(tail, blockSize);
+			Bytes::wipe(arena.data(), arena.size());
+		});
+		for (std::exception_ptr& i : failed) if (i) std::rethrow_exception(i);
+
+		// Step past every block used, then move the key on so this output cannot be regenerated
+		this->counter += blocks;
+		this->rekey(updateTag, nullptr, 0, nullptr, 0, true);
+	}
+	std::vector<byte> DRBG::generate(size_t len, uint workers) {
+		std::vector<byte> out(len);
+		this->generate(out.data(), len, workers);
+		return out;
+	}
+}
+}
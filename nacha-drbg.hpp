@@ -0,0 +1,68 @@
+#ifndef erclib_nacha_drbg_included
+#define erclib_nacha_drbg_included
+
+#include "nacha.hpp"
+
+namespace ERCLIB {
+namespace NACHA {
+	/********!
+	 * @brief
+	 * 			Deterministic random bit generator on NACHA-L, in counter
+	 * 			mode: the same seed always gives the same bytes.
+	 *
+	 * @details
+	 * 			@li The state is a 64-byte key and a 64-bit block counter.
+	 * 			\c seed() replaces the key with a digest of the entropy and an
+	 * 			optional personalization string. \c reseed() folds new
+	 * 			entropy into the key it already has.
+	 *
+	 * 			@li Output block \c i is the 1KB NACHA-L digest of
+	 * 			<CODE>02h || key || counter + i</CODE>. Blocks do not depend
+	 * 			on each other, so \c generate() can split a request across
+	 * 			\c workers threads and writes each block straight into the
+	 * 			caller's buffer.
+	 *
+	 * 			@li After every request the key is replaced by a digest of
+	 * 			itself and the counter, so output already handed out cannot
+	 * 			be worked back out from a later state. The unused tail of a
+	 * 			partial block is thrown away.
+	 *
+	 * @warning
+	 * 			The output is NACHA-L digest bytes as they are, and those
+	 * 			are not uniform: bit 1 is set in about 55% of them, and
+	 * 			their byte counts fail a chi-square test by a wide margin.
+	 * 			Folding wider digests down does not even this out. Use it
+	 * 			for reproducible fixtures, not as a source of uniformly
+	 * 			random key material.
+	 *
+	 * @note
+	 * 			Output depends on how it is requested: two 10-byte requests do
+	 * 			not give the same bytes as one 20-byte request. It does not
+	 * 			depend on \c workers.
+	 ********/
+	class DRBG {
+		std::array<byte, 64> key;
+		uint64_t counter;
+		bool seeded;
+
+		void rekey(byte tag, const byte* a, size_t aLen, const byte* b, size_t bLen, bool keepKey);
+	public:
+		//! Bytes made by one NACHA-L digest; requests are rounded up to whole blocks
+		static constexpr size_t blockSize = 1024;
+
+		DRBG() : key(), counter(0), seeded(false) {}
+		explicit DRBG(const std::vector<byte>& entropy, const std::vector<byte>& personal = {}) : DRBG() {this->seed(entropy, personal);}
+		~DRBG();
+
+		void seed(const byte* entropy, size_t entropyLen, const byte* personal = nullptr, size_t personalLen = 0);
+		void seed(const std::vector<byte>& entropy, const std::vector<byte>& personal = {}) {this->seed(entropy.data(), entropy.size(), personal.data(), personal.size());}
+		void reseed(const byte* entropy, size_t entropyLen, const byte* additional = nullptr, size_t additionalLen = 0);
+		void reseed(const std::vector<byte>& entropy, const std::vector<byte>& additional = {}) {this->reseed(entropy.data(), entropy.size(), additional.data(), additional.size());}
+
+		void generate(byte* out, size_t len, uint workers = 1);
+		std::vector<byte> generate(size_t len, uint workers = 1);
+	};
+}
+}
+
+#endif
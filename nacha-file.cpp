@@ -0,0 +1,412 @@
+/*
+ * nacha-file.cpp  --> File hashing helpers for nacha.hpp
+ * 
+ * Copyright (c) August 2021 Evan R. Clegern <evanclegern.work@gmail.com>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "nacha-file.hpp"
+#include "nacha-tree.hpp"
+#include "nacha-cache.hpp"
+#include "fileio.hpp"
+#include "threading.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <istream>
+#include <mutex>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ERCLIB {
+namespace NACHA {
+	namespace {
+		std::runtime_error fileError(const std::string& what, const std::string& path) {
+			return std::runtime_error(path + ": " + what + ": " + std::strerror(errno));
+		}
+		FileStamp stampOf(const struct stat& st) {
+			return FileStamp{uint64_t(st.st_dev), uint64_t(st.st_ino), uint64_t(st.st_size), int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec};
+		}
+		
+		//! A file changed within the last second may change again without its mtime moving, on coarse-clock filesystems
+		bool settled(const FileStamp& s) {
+			struct timespec now;
+			::clock_gettime(CLOCK_REALTIME, &now);
+			return s.mtimeNs + 1000000000 < int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+		}
+		
+		//! Looks \c path up in \c cache, or hashes it with \c fn and records the result if the file held still
+		template<class F> std::vector<byte> throughCache(const std::string& path, const Variant& v, bool tree, DigestCache* cache, F&& fn) {
+			std::vector<byte> out;
+			if (cache && cache->lookup(stampFile(path), v, tree, out)) return out;
+			MappedFile file(path);
+			out = fn(file);
+			if (cache && settled(file.stamp()) && file.restamp() == file.stamp()) cache->insert(file.stamp(), v, tree, out);
+			return out;
+		}
+		
+		//! Past this much arena, hashFile() runs hashStreamed() over the map instead; it is no slower there
+		const size_t streamAbove = size_t(1) << 20;
+		
+		//! One read() of up to \c len bytes, retried on EINTR; zero at the end of the input
+		size_t readSome(int fd, byte* dst, size_t len) {
+			for (;;) {
+				const ssize_t got = ::read(fd, dst, len);
+				if (got >= 0) return size_t(got);
+				if (errno != EINTR) throw std::runtime_error(std::string("NACHA could not read its input: ") + std::strerror(errno));
+			}
+		}
+		
+		//! An unlinked temporary file, for input that cannot be read twice
+		class Spool {
+			int fd;
+		public:
+			Spool() {
+				const char* dir = std::getenv("TMPDIR");
+				std::string name = std::string((dir && *dir) ? dir : "/tmp") + "/nacha-XXXXXX";
+				this->fd = ::mkstemp(&name[0]);
+				if (this->fd < 0) throw fileError("cannot create spool file", name);
+				::unlink(name.c_str());
+			}
+			~Spool() {::close(this->fd);}
+			
+			//! Appends everything \c next produces, until it returns zero
+			template<class F> int fill(F&& next) {
+				std::vector<byte> buf(65536);
+				for (size_t got; (got = next(buf.data(), buf.size())) > 0;) {
+					for (size_t at = 0; at < got;) {
+						const ssize_t put = ::write(this->fd, buf.data() + at, got - at);
+						if (put < 0 && errno == EINTR) continue;
+						if (put < 0) throw std::runtime_error(std::string("NACHA could not spool its input: ") + std::strerror(errno));
+						at += size_t(put);
+					}
+				}
+				std::fill(buf.begin(), buf.end(), 0); //basic memory sanitation
+				return this->fd;
+			}
+		};
+	}
+	
+	FileStamp stampFile(const std::string& path) {
+		struct stat st;
+		if (::stat(path.c_str(), &st) != 0) throw fileError("cannot stat", path);
+		return stampOf(st);
+	}
+	
+	MappedFile::MappedFile(const std::string& path) : handle(-1), base(nullptr), length(0), stamped() {
+		this->handle = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (this->handle < 0) throw fileError("cannot open", path);
+		struct stat st;
+		if (::fstat(this->handle, &st) != 0) {
+			std::runtime_error e = fileError("cannot stat", path);
+			::close(this->handle);
+			throw e;
+		}
+		if (S_ISDIR(st.st_mode)) {
+			::close(this->handle);
+			throw std::runtime_error(path + ": is a directory");
+		}
+		this->length = uint64_t(st.st_size);
+		this->stamped = stampOf(st);
+		if (this->length == 0) return;
+		void* map = ::mmap(nullptr, size_t(this->length), PROT_READ, MAP_PRIVATE, this->handle, 0);
+		if (map == MAP_FAILED) {
+			std::runtime_error e = fileError("cannot map", path);
+			::close(this->handle);
+			throw e;
+		}
+		::madvise(map, size_t(this->length), MADV_SEQUENTIAL);
+		this->base = static_cast<const byte*>(map);
+	}
+	MappedFile::~MappedFile() {
+		if (this->base) ::munmap(const_cast<byte*>(this->base), size_t(this->length));
+		if (this->handle >= 0) ::close(this->handle);
+	}
+	FileStamp MappedFile::restamp() const {
+		struct stat st;
+		if (::fstat(this->handle, &st) != 0) throw std::runtime_error(std::string("cannot stat mapped file: ") + std::strerror(errno));
+		return stampOf(st);
+	}
+	
+	/********!
+	 * @brief
+	 * 			Digest of the file at \c path, as the matching hashData
+	 * 			function would give for its contents.
+	 * 
+	 * @details
+	 * 			The file is mapped rather than read, so it is never held in
+	 * 			memory twice, and \c arena may be reused between files. The
+	 * 			plan is built before the data is read, so a file past the
+	 * 			size limit of \c hash() is refused without touching it.
+	 * 			Files whose arena would pass 1MB go through \c hashStreamed()
+	 * 			and leave \c arena alone.
+	 * 
+	 * 			A \c cache hit costs one stat() and no reads. Digests are
+	 * 			only added to it if the file did not change while hashing,
+	 * 			and was last modified more than a second before.
+	 ********/
+	std::vector<byte> hashFile(const std::string& path, const Variant& v, std::vector<byte>& arena, DigestCache* cache) {
+		return throughCache(path, v, false, cache, [&](const MappedFile& file) {
+			const HashPlan plan(size_t(file.size()), v.capac, v.blkA, v.blkB);
+			std::vector<byte> out(v.capac);
+			if (plan.arenaSize > streamAbove) {
+				const byte* data = file.data();
+				hashStreamed(plan, [data](uint64_t offset, size_t len, byte* dst) {std::memcpy(dst, data + offset, len);}, out.data());
+				return out;
+			}
+			hash(plan, file.data(), arena, out.data());
+			std::fill(arena.begin(), arena.begin() + plan.arenaSize, 0); //basic memory sanitation
+			return out;
+		});
+	}
+	std::vector<byte> hashFile(const std::string& path, const Variant& v) {
+		std::vector<byte> arena;
+		return hashFile(path, v, arena);
+	}
+	//! NACHA Tree digest of the file at \c path, read leaf by leaf; works for files of any size
+	std::vector<byte> treeHashFile(const std::string& path, const Variant& v, uint workers, DigestCache* cache) {
+		return throughCache(path, v, true, cache, [&](const MappedFile& file) {
+			TreeIndex T(v.capac, v.blkA, v.blkB);
+			T.build(file.fd(), workers);
+			return T.root();
+		});
+	}
+	
+	/********!
+	 * @brief
+	 * 			Digest of everything readable from \c fd, as the matching
+	 * 			hashData function would give, in constant memory.
+	 * 
+	 * @details
+	 * 			Regular files are read in place with pread(), leaving the
+	 * 			file offset alone; anything else (pipes, sockets, ttys) is
+	 * 			first copied to an unlinked file under $TMPDIR, since
+	 * 			\c hashStreamed() reads its input more than once.
+	 * 
+	 * 			Peak memory is fixed: under 64KB for the pipeline and its
+	 * 			read windows, plus a 64KB copy buffer when spooling. It does
+	 * 			not depend on the size of the input.
+	 ********/
+	std::vector<byte> hashFd(int fd, const Variant& v) {
+		struct stat st;
+		if (::fstat(fd, &st) != 0) throw std::runtime_error(std::string("NACHA could not stat its input: ") + std::strerror(errno));
+		if (!S_ISREG(st.st_mode)) {
+			Spool spool;
+			return hashFd(spool.fill([fd](byte* dst, size_t len) {return readSome(fd, dst, len);}), v);
+		}
+		const HashPlan plan(size_t(st.st_size), v.capac, v.blkA, v.blkB);
+		std::vector<byte> out(v.capac);
+		hashStreamed(plan, [fd](uint64_t offset, size_t len, byte* dst) {FileIO::preadAll(fd, offset, len, dst);}, out.data());
+		return out;
+	}
+	//! NACHA Tree digest of everything readable from \c fd, spooling it first as \c hashFd() does when it is not a regular file
+	std::vector<byte> treeHashFd(int fd, const Variant& v, uint workers) {
+		struct stat st;
+		if (::fstat(fd, &st) != 0) throw std::runtime_error(std::string("NACHA could not stat its input: ") + std::strerror(errno));
+		if (!S_ISREG(st.st_mode)) {
+			Spool spool;
+			return treeHashFd(spool.fill([fd](byte* dst, size_t len) {return readSome(fd, dst, len);}), v, workers);
+		}
+		TreeIndex T(v.capac, v.blkA, v.blkB);
+		T.build(fd, workers);
+		return T.root();
+	}
+	//! As \c hashFd(), over the rest of \c in; seekable streams are read in place, others spooled
+	std::vector<byte> hashStream(std::istream& in, const Variant& v) {
+		const std::istream::pos_type start = in.tellg();
+		if (start == std::istream::pos_type(-1) || !in.seekg(0, std::ios::end)) {
+			in.clear();
+			Spool spool;
+			return hashFd(spool.fill([&in](byte* dst, size_t len) -> size_t {
+				in.read(reinterpret_cast<char*>(dst), std::streamsize(len));
+				return size_t(in.gcount());
+			}), v);
+		}
+		const uint64_t size = uint64_t(in.tellg() - start);
+		const HashPlan plan(size_t(size), v.capac, v.blkA, v.blkB);
+		std::vector<byte> out(v.capac);
+		hashStreamed(plan, [&in, start](uint64_t offset, size_t len, byte* dst) {
+			in.seekg(start + std::streamoff(offset));
+			if (!in.read(reinterpret_cast<char*>(dst), std::streamsize(len))) throw std::runtime_error("NACHA input stream ended early!");
+		}, out.data());
+		in.seekg(0, std::ios::end);
+		return out;
+	}
+	
+	std::string toHex(const std::vector<byte>& digest) {
+		static const char digits[] = "0123456789abcdef";
+		std::string out;
+		out.reserve(digest.size() * 2);
+		for (byte i : digest) {
+			out += digits[i >> 4];
+			out += digits[i & 15];
+		}
+		return out;
+	}
+	//! Parses lower- or upper-case hex, throwing std::invalid_argument on anything else
+	std::vector<byte> fromHex(const std::string& hex) {
+		if (hex.size() & 1) throw std::invalid_argument("Hex digest has an odd number of digits!");
+		auto nibble = [](char c) -> byte {
+			if (c >= '0' && c <= '9') return byte(c - '0');
+			if (c >= 'a' && c <= 'f') return byte(c - 'a' + 10);
+			if (c >= 'A' && c <= 'F') return byte(c - 'A' + 10);
+			throw std::invalid_argument("Hex digest contains a non-hex character!");
+		};
+		std::vector<byte> out;
+		out.reserve(hex.size() / 2);
+		for (size_t i = 0; i < hex.size(); i += 2) out.push_back(byte((nibble(hex[i]) << 4) | nibble(hex[i + 1])));
+		return out;
+	}
+	
+	/********!
+	 * @brief
+	 * 			Digest comparison that always looks at every byte.
+	 * 
+	 * @details
+	 * 			Differences are OR-ed into a volatile accumulator, so the
+	 * 			compiler cannot turn the loop into an early-out memcmp().
+	 * 			Lengths are public (they follow from the variant), so a
+	 * 			length mismatch returns at once.
+	 ********/
+	bool digestsEqual(const std::vector<byte>& a, const std::vector<byte>& b) noexcept {
+		if (a.size() != b.size()) return false;
+		volatile byte diff = 0;
+		for (size_t i = 0; i < a.size(); i++) diff = byte(diff | (a[i] ^ b[i]));
+		return diff == 0;
+	}
+	
+	namespace {
+		//! Asks the kernel to start reading the head of \c path; errors are left for the real read to report
+		void prefetch(const std::string& path, size_t bytes) {
+			const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+			if (fd < 0) return;
+			::posix_fadvise(fd, 0, off_t(bytes), POSIX_FADV_WILLNEED);
+			::close(fd);
+		}
+		
+		Verification verifyEntry(const ManifestEntry& e, std::vector<byte>& arena, DigestCache* cache) {
+			Verification out;
+			try {
+				const std::vector<byte> got = e.tree ? treeHashFile(e.path, *e.variant, 1, cache) : hashFile(e.path, *e.variant, arena, cache);
+				out.verdict = digestsEqual(got, e.expected) ? Verdict::ok : Verdict::mismatch;
+			} catch (const std::exception& x) {
+				out.verdict = Verdict::unreadable;
+				out.error = x.what();
+				if (out.error.compare(0, e.path.size() + 1, e.path + ":") != 0) out.error = e.path + ": " + out.error;
+			}
+			return out;
+		}
+	}
+	
+	/********!
+	 * @brief
+	 * 			Checks every file of \c manifest against its expected
+	 * 			digest, on a pool of \c opt.workers threads.
+	 * 
+	 * @details
+	 * 			Workers claim entries from an atomic counter, each keeping
+	 * 			its own arena. Before hashing its entry, a worker hints the
+	 * 			next few files (up to \c opt.readAhead past it) to the
+	 * 			kernel, so the pool rarely waits on a cold disk. Read-ahead
+	 * 			is left off with a \c cache, where most files are never
+	 * 			read at all.
+	 * 
+	 * 			Entries past an exhausted failure budget are not opened and
+	 * 			come back as \c Verdict::skipped. Entries already being
+	 * 			hashed when it runs out still finish.
+	 * 
+	 * @return
+	 * 			One result per entry, in manifest order.
+	 ********/
+	std::vector<Verification> verifyManifest(const std::vector<ManifestEntry>& manifest, const VerifyOptions& opt, const VerifyReport& report) {
+		const size_t count = manifest.size();
+		std::vector<Verification> out(count);
+		std::vector<char> finished(count, 0);
+		std::atomic<size_t> next(0), hinted(0), failures(0);
+		std::mutex reportLock;
+		size_t reported = 0;
+		const uint workers = std::max<uint>(1, std::min<size_t>(opt.workers, count));
+		Threading::forRange(workers, workers, [&](size_t, size_t, uint) {
+			std::vector<byte> arena;
+			for (size_t i = next++; i < count; i = next++) {
+				if (!opt.failureBudget || failures.load() < opt.failureBudget) {
+					const size_t horizon = std::min(count, i + 1 + opt.readAhead);
+					for (size_t p = hinted.load(); !opt.cache && p < horizon; p = hinted.load()) {
+						if (hinted.compare_exchange_weak(p, p + 1) && p > i) prefetch(manifest[p].path, opt.prefetchBytes);
+					}
+					out[i] = verifyEntry(manifest[i], arena, opt.cache);
+					if (out[i].verdict != Verdict::ok) failures++;
+					std::fill(arena.begin(), arena.end(), 0); //basic memory sanitation
+				}
+				std::lock_guard<std::mutex> L(reportLock);
+				finished[i] = 1;
+				for (; reported < count && finished[reported]; reported++) if (report) report(reported, out[reported]);
+			}
+		});
+		return out;
+	}
+	
+	/********!
+	 * @brief
+	 * 			Reads one manifest line into \c out, returning false if it
+	 * 			is not one.
+	 * 
+	 * @details
+	 * 			Two forms are accepted, as with sha256sum:
+	 * 			@li <CODE>digest  path</CODE> (or <CODE>digest *path</CODE>),
+	 * 			hashed with \c untagged and \c untaggedTree;
+	 * 			@li <CODE>NACHA-512E (path) = digest</CODE>, which names its
+	 * 			own variant, with a <CODE>-TREE</CODE> suffix for NACHA Tree
+	 * 			digests.
+	 ********/
+	bool parseManifestLine(const std::string& line, const Variant& untagged, bool untaggedTree, ManifestEntry& out) {
+		static const std::string tag = "NACHA-", treeTag = "-TREE";
+		try {
+			if (line.compare(0, tag.size(), tag) == 0) {
+				const size_t open = line.find(" (");
+				const size_t close = line.rfind(") = ");
+				if (open == std::string::npos || close == std::string::npos || close <= open) return false;
+				std::string name = line.substr(tag.size(), open - tag.size());
+				out.tree = name.size() > treeTag.size() && name.compare(name.size() - treeTag.size(), treeTag.size(), treeTag) == 0;
+				if (out.tree) name.resize(name.size() - treeTag.size());
+				out.variant = &findVariant(name);
+				out.path = line.substr(open + 2, close - open - 2);
+				out.expected = fromHex(line.substr(close + 4));
+			} else {
+				const size_t digits = size_t(untagged.capac) * 2;
+				if (line.size() < digits + 3 || line[digits] != ' ') return false;
+				if (line[digits + 1] != ' ' && line[digits + 1] != '*') return false;
+				out.variant = &untagged;
+				out.tree = untaggedTree;
+				out.path = line.substr(digits + 2);
+				out.expected = fromHex(line.substr(0, digits));
+			}
+		} catch (const std::invalid_argument&) {
+			return false;
+		}
+		return !out.path.empty() && out.expected.size() == out.variant->capac;
+	}
+	//! The line \c parseManifestLine() reads back; \c tagged names the variant, as \c nacha-sum \c --tag prints
+	std::string manifestLine(const ManifestEntry& entry, bool tagged) {
+		if (!tagged) return toHex(entry.expected) + "  " + entry.path;
+		return std::string("NACHA-") + entry.variant->name + (entry.tree ? "-TREE" : "") + " (" + entry.path + ") = " + toHex(entry.expected);
+	}
+}
+}
@@ -0,0 +1,95 @@
+#ifndef erclib_nacha_file_included
+#define erclib_nacha_file_included
+
+#include "nacha.hpp"
+#include <cstdint>
+#include <iosfwd>
+
+namespace ERCLIB {
+namespace NACHA {
+	class DigestCache;
+	
+	//! What identifies one version of a file without reading it: the inode, its length and its change time
+	struct FileStamp {
+		uint64_t device, inode, size;
+		int64_t mtimeNs;
+		
+		bool operator==(const FileStamp& o) const noexcept {return device == o.device && inode == o.inode && size == o.size && mtimeNs == o.mtimeNs;};
+		bool operator!=(const FileStamp& o) const noexcept {return !(*this == o);};
+	};
+	extern FileStamp stampFile(const std::string& path);
+	
+	//! Read-only memory map of a whole file; empty files map to nothing
+	class MappedFile {
+		int handle;
+		const byte* base;
+		uint64_t length;
+		FileStamp stamped;
+	public:
+		explicit MappedFile(const std::string& path);
+		~MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		
+		const byte* data() const noexcept {return this->base;};
+		uint64_t size() const noexcept {return this->length;};
+		int fd() const noexcept {return this->handle;};
+		const FileStamp& stamp() const noexcept {return this->stamped;};
+		FileStamp restamp() const; //fstat again, to see whether the file moved under the map
+	};
+	
+	//! With a \c cache, unchanged files are answered from it after a single stat(), and new digests are added to it
+	extern std::vector<byte> hashFile(const std::string& path, const Variant& v, std::vector<byte>& arena, DigestCache* cache = nullptr);
+	extern std::vector<byte> hashFile(const std::string& path, const Variant& v);
+	extern std::vector<byte> treeHashFile(const std::string& path, const Variant& v, uint workers = 1, DigestCache* cache = nullptr);
+	extern std::vector<byte> hashFd(int fd, const Variant& v);
+	extern std::vector<byte> treeHashFd(int fd, const Variant& v, uint workers = 1);
+	extern std::vector<byte> hashStream(std::istream& in, const Variant& v);
+	
+	extern std::string toHex(const std::vector<byte>& digest);
+	extern std::vector<byte> fromHex(const std::string& hex);
+	
+	//! Compares two digests in time that depends only on their lengths, never on where they differ
+	extern bool digestsEqual(const std::vector<byte>& a, const std::vector<byte>& b) noexcept;
+	
+	//! One file a manifest vouches for: its path, how it was hashed and the digest it must have
+	struct ManifestEntry {
+		std::string path;
+		const Variant* variant;
+		bool tree;
+		std::vector<byte> expected;
+	};
+	//! \c skipped entries were never read, because the failure budget ran out first
+	enum class Verdict : byte {ok, mismatch, unreadable, skipped};
+	struct Verification {
+		Verdict verdict = Verdict::skipped;
+		std::string error; //why an unreadable entry could not be hashed
+	};
+	
+	/********!
+	 * @brief
+	 * 			How \c verifyManifest() runs.
+	 * 
+	 * @details
+	 * 			\c readAhead files past the newest one claimed are hinted to
+	 * 			the kernel, so their first \c prefetchBytes are on their way
+	 * 			in while earlier files hash. Once \c failureBudget entries
+	 * 			have failed, no further files are opened; zero means no
+	 * 			budget.
+	 ********/
+	struct VerifyOptions {
+		uint workers = 1, readAhead = 8;
+		size_t prefetchBytes = size_t(8) << 20;
+		size_t failureBudget = 0;
+		DigestCache* cache = nullptr;
+	};
+	//! Called once per entry, in manifest order, as soon as every entry before it has been reported
+	typedef std::function<void(size_t index, const Verification& result)> VerifyReport;
+	
+	extern std::vector<Verification> verifyManifest(const std::vector<ManifestEntry>& manifest, const VerifyOptions& opt, const VerifyReport& report = nullptr);
+	extern bool parseManifestLine(const std::string& line, const Variant& untagged, bool untaggedTree, ManifestEntry& out);
+	extern std::string manifestLine(const ManifestEntry& entry, bool tagged);
+}
+}
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * nacha-kdf.cpp  --> Memory-hard key derivation for nacha-kdf.hpp
+ *
+ * Copyright (c) August 2021 Evan R. Clegern <evanclegern.work@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "nacha-kdf.hpp"
+#include "bytes.hpp"
+#include "threading.hpp"
+#include <algorithm>
+#include <exception>
+
+namespace ERCLIB {
+namespace NACHA {
+	namespace {
+		//! Every digest here is NACHA-L with the 512 block sizes; only the capacity changes
+		const byte kdfBlkA = 11, kdfBlkB = 6;
+		const size_t seedSize = 64;
+		const uint slices = 4;
+
+		//! \c outLen bytes from \c seed, as 64-byte digests of <CODE>counter || outLen || seed</CODE>
+		void expand(const byte* seed, size_t seedLen, byte* out, size_t outLen) {
+			std::vector<byte> msg(12 + seedLen), digest(seedSize);
+			Bytes::putLE(msg.data() + 4, outLen, 8);
+			std::copy(seed, seed + seedLen, msg.begin() + 12);
+			for (size_t at = 0, i = 0; at < outLen; at += seedSize, i++) {
+				Bytes::putLE(msg.data(), i, 4);
+				hashL(msg.data(), msg.size(), digest.data(), seedSize, kdfBlkA, kdfBlkB);
+				std::copy(digest.begin(), digest.begin() + std::min(seedSize, outLen - at), out + at);
+			}
+			Bytes::wipe(msg.data(), msg.size()); //basic memory sanitation
+			Bytes::wipe(digest.data(), digest.size());
+		}
+
+		//! The memory matrix: \c lanes rows of \c laneLen blocks, each row cut into four slices of \c segLen
+		struct Matrix {
+			std::vector<byte> mem;
+			size_t laneLen, segLen;
+			uint lanes;
+
+			byte* block(uint l, size_t j) {return this->mem.data() + (((l * this->laneLen) + j) * kdfBlock);}
+		};
+
+		//! One lane's working memory: G's input and digest, and the arena its NACHA-L plan runs in
+		struct LaneWork {
+			std::vector<byte> R, Z, arena;
+			LaneWork() : R(kdfBlock), Z(kdfBlock) {}
+			~LaneWork() {
+				Bytes::wipe(this->R.data(), this->R.size()); //basic memory sanitation
+				Bytes::wipe(this->Z.data(), this->Z.size());
+				Bytes::wipe(this->arena.data(), this->arena.size());
+			}
+		};
+
+		/********!
+		 * @brief
+		 * 			Fills slice \c s of lane \c l on pass \c t.
+		 *
+		 * @details
+		 * 			The reference lane and block come from the previous
+		 * 			block, as in Argon2d. Within the lane, any finished
+		 * 			block but the previous one may be picked. In other
+		 * 			lanes, only slices that are not being written right
+		 * 			now. The position is biased towards recent blocks by
+		 * 			Argon2's squaring map.
+		 ********/
+		void fillSlice(Matrix& M, uint t, uint s, uint l, const HashPlan& plan, LaneWork& W) {
+			for (size_t idx = (t == 0 && s == 0) ? 2 : 0; idx < M.segLen; idx++) {
+				const size_t j = (s * M.segLen) + idx;
+				const byte* prev = M.block(l, j ? (j - 1) : (M.laneLen - 1));
+				const uint64_t pick = Bytes::getLE(prev, 8);
+				const uint64_t J1 = pick & 0xFFFFFFFF, J2 = pick >> 32;
+				const uint refLane = (t == 0 && s == 0) ? l : uint(J2 % M.lanes);
+
+				size_t begin = 0, area;
+				if (t == 0) {
+					area = (refLane == l) ? (j - 1) : ((s * M.segLen) - (idx == 0));
+				} else {
+					begin = ((s + 1) * M.segLen) % M.laneLen;
+					area = (refLane == l) ? (M.laneLen - M.segLen + idx - 1) : (M.laneLen - M.segLen - (idx == 0));
+				}
+				uint64_t x = (J1 * J1) >> 32;
+				x = area - 1 - ((area * x) >> 32);
+				const byte* ref = M.block(refLane, (begin + x) % M.laneLen);
+
+				// G(X, Y) = H(X ^ Y) ^ X ^ Y; later passes XOR it into what is there
+				byte* cur = M.block(l, j);
+				for (size_t i = 0; i < kdfBlock; i++) W.R[i] = prev[i] ^ ref[i];
+				hash(plan, W.R.data(), W.arena, W.Z.data());
+				if (t == 0) {
+					for (size_t i = 0; i < kdfBlock; i++) cur[i] = W.Z[i] ^ W.R[i];
+				} else {
+					for (size_t i = 0; i < kdfBlock; i++) cur[i] ^= W.Z[i] ^ W.R[i];
+				}
+			}
+		}
+	}
+
+	void deriveKey(const byte* password, size_t passwordLen, const byte* salt, size_t saltLen, byte* out, size_t outLen, uint timeCost, uint memCost, uint lanes) {
+		if (saltLen < 8) throw std::invalid_argument("Salt provided to NACHA deriveKey must be at least eight bytes!");
+		if (outLen == 0) throw std::invalid_argument("NACHA deriveKey cannot make an empty key!");
+		if (timeCost == 0) throw std::invalid_argument("Time cost provided to NACHA deriveKey must be at least one pass!");
+		if (lanes == 0) throw std::invalid_argument("NACHA deriveKey needs at least one lane!");
+		if (memCost / lanes < 2 * slices) throw std::invalid_argument("Memory cost provided to NACHA deriveKey must be at least eight blocks per lane!");
+
+		// Seed: every parameter, then the length-prefixed password and salt
+		std::vector<byte> msg(40 + passwordLen + saltLen), seed(seedSize + 8);
+		Bytes::putLE(msg.data(), lanes, 4);
+		Bytes::putLE(msg.data() + 4, outLen, 8);
+		Bytes::putLE(msg.data() + 12, memCost, 4);
+		Bytes::putLE(msg.data() + 16, timeCost, 4);
+		Bytes::putLE(msg.data() + 20, kdfVersion, 4);
+		Bytes::putLE(msg.data() + 24, passwordLen, 8);
+		std::copy(password, password + passwordLen, msg.begin() + 32);
+		Bytes::putLE(msg.data() + 32 + passwordLen, saltLen, 8);
+		std::copy(salt, salt + saltLen, msg.begin() + 40 + passwordLen);
+		hashL(msg.data(), msg.size(), seed.data(), seedSize, kdfBlkA, kdfBlkB);
+		Bytes::wipe(msg.data(), msg.size()); //basic memory sanitation
+
+		Matrix M;
+		M.lanes = lanes;
+		M.segLen = memCost / (slices * lanes);
+		M.laneLen = M.segLen * slices;
+		M.mem.resize(M.laneLen * lanes * kdfBlock);
+		for (uint l = 0; l < lanes; l++) {
+			for (uint j = 0; j < 2; j++) {
+				Bytes::putLE(seed.data() + seedSize, j, 4);
+				Bytes::putLE(seed.data() + seedSize + 4, l, 4);
+				expand(seed.data(), seed.size(), M.block(l, j), kdfBlock);
+			}
+		}
+		Bytes::wipe(seed.data(), seed.size());
+
+		// Lanes meet at every slice boundary; between them each one only writes its own slice
+		const HashPlan plan(kdfBlock, kdfBlock, kdfBlkA, kdfBlkB, 1, true);
+		std::vector<LaneWork> work(lanes);
+		std::vector<std::exception_ptr> failed(lanes);
+		for (uint t = 0; t < timeCost; t++) {
+			for (uint s = 0; s < slices; s++) {
+				Threading::forRange(lanes, lanes, [&](size_t first, size_t last, uint w) {
+					try {
+						for (size_t l = first; l < last; l++) fillSlice(M, t, s, uint(l), plan, work[w]);
+					} catch (...) {
+						failed[w] = std::current_exception();
+					}
+				});
+				for (std::exception_ptr& i : failed) if (i) std::rethrow_exception(i);
+			}
+		}
+
+		// Fold the last block of every lane together, then stretch it to outLen
+		std::vector<byte> last(M.block(0, M.laneLen - 1), M.block(0, M.laneLen - 1) + kdfBlock);
+		for (uint l = 1; l < lanes; l++) {
+			const byte* b = M.block(l, M.laneLen - 1);
+			for (size_t i = 0; i < kdfBlock; i++) last[i] ^= b[i];
+		}
+		Bytes::wipe(M.mem.data(), M.mem.size());
+		expand(last.data(), last.size(), out, outLen);
+		Bytes::wipe(last.data(), last.size());
+	}
+	std::vector<byte> deriveKey(const std::vector<byte>& password, const std::vector<byte>& salt, size_t outLen, uint timeCost, uint memCost, uint lanes) {
+		std::vector<byte> out(outLen);
+		deriveKey(password.data(), password.size(), salt.data(), salt.size(), out.data(), outLen, timeCost, memCost, lanes);
+		return out;
+	}
+}
+}
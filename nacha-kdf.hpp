@@ -0,0 +1,68 @@
+#ifndef erclib_nacha_kdf_included
+#define erclib_nacha_kdf_included
+
+#include "nacha.hpp"
+
+namespace ERCLIB {
+namespace NACHA {
+	//! Version of the construction behind \c deriveKey(); it is hashed into every key, so a change gets a new number
+	constexpr uint kdfVersion = 1;
+	//! Size of one block of the memory matrix; \c memCost counts these
+	constexpr size_t kdfBlock = 1024;
+
+	/********!
+	 * @brief
+	 * 			Memory-hard key derivation built on NACHA-L, laid out like
+	 * 			Argon2d.
+	 *
+	 * @param [in] password
+	 * 			Secret to derive from; any length, including empty.
+	 * @param [in] salt
+	 * 			At least eight bytes, unique per password.
+	 * @param [in] outLen
+	 * 			Exact length of the key returned, e.g. 60 for a VIPER-1
+	 * 			key or 12 for its IV.
+	 * @param [in] timeCost
+	 * 			Passes over the memory matrix, at least one.
+	 * @param [in] memCost
+	 * 			Size of the matrix, in 1KB blocks; at least eight per lane.
+	 * 			It is rounded down to a multiple of <CODE>4 * lanes</CODE>.
+	 * @param [in] lanes
+	 * 			Independent rows of the matrix, each filled on its own
+	 * 			thread. They change the key, so it is a parameter to fix
+	 * 			rather than a thread count to tune per machine.
+	 *
+	 * @details
+	 * 			@li A 64-byte seed is hashed from every parameter, the
+	 * 			password and the salt, each length-prefixed.
+	 *
+	 * 			@li Each lane's first two blocks are expanded from the seed.
+	 * 			Every later block is G(previous, reference), where
+	 * 			<CODE>G(X, Y) = H(X ^ Y) ^ X ^ Y</CODE> and H is a
+	 * 			1KB NACHA-L digest of the block. The reference is picked by
+	 * 			the previous block's first eight bytes, from blocks already
+	 * 			finished in any lane.
+	 *
+	 * 			@li Each pass is cut into four slices. Lanes only reference
+	 * 			each other's finished slices, so they run side by side and
+	 * 			meet at each slice boundary. Later passes XOR into the
+	 * 			blocks instead of replacing them.
+	 *
+	 * 			@li The last blocks of every lane are XORed together and
+	 * 			expanded to \c outLen bytes.
+	 *
+	 * @note
+	 * 			References depend on the data, as in Argon2d, so the pattern
+	 * 			of memory access leaks timing about the password. Use it where
+	 * 			an attacker cannot watch the machine doing the work.
+	 *
+	 * @exception std::invalid_argument
+	 * 			For a short salt, a zero \c outLen, \c timeCost or \c lanes,
+	 * 			or too little memory for the lanes.
+	 ********/
+	extern std::vector<byte> deriveKey(const std::vector<byte>& password, const std::vector<byte>& salt, size_t outLen, uint timeCost, uint memCost, uint lanes = 1);
+	extern void deriveKey(const byte* password, size_t passwordLen, const byte* salt, size_t saltLen, byte* out, size_t outLen, uint timeCost, uint memCost, uint lanes = 1);
+}
+}
+
+#endif
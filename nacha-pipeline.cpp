@@ -0,0 +1,167 @@
+/*
+ * nacha-pipeline.cpp  --> Lock-free record hashing pipeline for nacha-pipeline.hpp
+ *
+ * Copyright (c) August 2021 Evan R. Clegern <evanclegern.work@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "nacha-pipeline.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace ERCLIB {
+namespace NACHA {
+	namespace {
+		const uint64_t stFree = 0, stFilled = 1, stHashed = 2;
+
+		//! Spins briefly, then yields, then sleeps; an idle stage costs next to no CPU
+		class Backoff {
+			uint rounds = 0;
+		public:
+			void wait() {
+				if (this->rounds < 64) {
+					this->rounds++;
+				} else if (this->rounds < 128) {
+					this->rounds++;
+					std::this_thread::yield();
+				} else {
+					std::this_thread::sleep_for(std::chrono::microseconds(50));
+				}
+			}
+		};
+	}
+
+	RecordPipeline::RecordPipeline(const Variant& v, uint workers, size_t slots) : variant(v), mask(slots - 1), ring(), head(), claimed(), closed(false), tail(0) {
+		if (v.capac > maxDigest) throw std::invalid_argument("NACHA RecordPipeline digests can be at most 96 bytes!");
+		if (slots < 2 || (slots & (slots - 1))) throw std::invalid_argument("NACHA RecordPipeline needs a power-of-two slot count of at least two!");
+		if (workers == 0) throw std::invalid_argument("NACHA RecordPipeline needs at least one worker!");
+		this->ring.reset(new Slot[slots]);
+		for (size_t i = 0; i < slots; i++) this->ring[i].state.store((uint64_t(i) * 4) + stFree, std::memory_order_relaxed);
+		this->head.value.store(0, std::memory_order_relaxed);
+		this->claimed.value.store(0, std::memory_order_relaxed);
+		this->pool.reserve(workers);
+		for (uint t = 0; t < workers; t++) this->pool.emplace_back([this]() {this->work();});
+	}
+	RecordPipeline::~RecordPipeline() {
+		this->close();
+		for (std::thread& i : this->pool) i.join();
+		for (uint64_t i = 0; i <= this->mask; i++) std::fill(this->ring[i].digest, this->ring[i].digest + maxDigest, 0); //basic memory sanitation
+	}
+
+	//! True once no record will ever be queued at \c sequence
+	bool RecordPipeline::drained(uint64_t sequence) const noexcept {
+		return this->closed.load(std::memory_order_acquire) && sequence >= this->head.value.load(std::memory_order_acquire);
+	}
+
+	/********!
+	 * @brief
+	 * 			Claims the slot for the next sequence number, if it is
+	 * 			free, and fills it.
+	 *
+	 * @details
+	 * 			The slot for sequence \c h is free when its state is
+	 * 			exactly <CODE>4h</CODE>. A smaller state means it still
+	 * 			holds the record from the lap before, so the ring is full.
+	 * 			A larger one means another producer won it first.
+	 *
+	 * @exception std::runtime_error
+	 * 			If the pipeline has been closed.
+	 ********/
+	bool RecordPipeline::tryPush(const byte* data, size_t len, uint64_t tag, uint64_t* sequence) {
+		if (this->closed.load(std::memory_order_relaxed)) throw std::runtime_error("NACHA RecordPipeline cannot take records once closed!");
+		uint64_t h = this->head.value.load(std::memory_order_relaxed);
+		Slot* S;
+		while (true) {
+			S = &this->ring[h & this->mask];
+			const uint64_t st = S->state.load(std::memory_order_acquire);
+			if (st == (h * 4) + stFree) {
+				if (this->head.value.compare_exchange_weak(h, h + 1, std::memory_order_relaxed)) break;
+			} else if (st < (h * 4) + stFree) {
+				return false;
+			} else {
+				h = this->head.value.load(std::memory_order_relaxed);
+			}
+		}
+		S->data = data;
+		S->len = len;
+		S->tag = tag;
+		S->state.store((h * 4) + stFilled, std::memory_order_release);
+		if (sequence) *sequence = h;
+		return true;
+	}
+	uint64_t RecordPipeline::push(const byte* data, size_t len, uint64_t tag) {
+		uint64_t sequence;
+		for (Backoff b; !this->tryPush(data, len, tag, &sequence);) b.wait();
+		return sequence;
+	}
+
+	//! Hands over the slot for \c tail once it is hashed, and frees it for the sequence one lap on
+	bool RecordPipeline::tryPop(Completion& out) {
+		Slot& S = this->ring[this->tail & this->mask];
+		if (S.state.load(std::memory_order_acquire) != (this->tail * 4) + stHashed) return false;
+		out.sequence = this->tail;
+		out.tag = S.tag;
+		out.size = this->variant.capac;
+		out.failed = S.failed;
+		std::copy(S.digest, S.digest + this->variant.capac, out.digest.begin());
+		S.state.store((this->tail + this->mask + 1) * 4 + stFree, std::memory_order_release);
+		this->tail++;
+		return true;
+	}
+	bool RecordPipeline::pop(Completion& out) {
+		for (Backoff b; !this->tryPop(out); b.wait()) {
+			if (this->drained(this->tail)) return false;
+		}
+		return true;
+	}
+	void RecordPipeline::close() noexcept {
+		this->closed.store(true, std::memory_order_release);
+	}
+
+	/********!
+	 * @brief
+	 * 			One worker: takes the next sequence number, waits for its
+	 * 			record and hashes it in place.
+	 *
+	 * @details
+	 * 			Workers may run ahead of the producers, each waiting on
+	 * 			the one sequence number it took. They stop when the
+	 * 			pipeline is closed and their number was never pushed.
+	 ********/
+	void RecordPipeline::work() {
+		std::vector<byte> arena;
+		while (true) {
+			const uint64_t s = this->claimed.value.fetch_add(1, std::memory_order_relaxed);
+			Slot& S = this->ring[s & this->mask];
+			for (Backoff b; S.state.load(std::memory_order_acquire) != (s * 4) + stFilled; b.wait()) {
+				if (this->drained(s)) {
+					std::fill(arena.begin(), arena.end(), 0); //basic memory sanitation
+					return;
+				}
+			}
+			try {
+				const HashPlan plan(S.len, this->variant.capac, this->variant.blkA, this->variant.blkB);
+				hash(plan, S.data, arena, S.digest);
+				S.failed = false;
+			} catch (const std::exception&) {
+				std::fill(S.digest, S.digest + maxDigest, 0);
+				S.failed = true;
+			}
+			S.state.store((s * 4) + stHashed, std::memory_order_release);
+		}
+	}
+}
+}
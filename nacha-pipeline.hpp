@@ -0,0 +1,95 @@
+#ifndef erclib_nacha_pipeline_included
+#define erclib_nacha_pipeline_included
+
+#include "nacha.hpp"
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace ERCLIB {
+namespace NACHA {
+	/********!
+	 * @brief
+	 * 			Hashes a stream of records on a pool of worker threads,
+	 * 			handing the digests back in the order the records came in.
+	 *
+	 * @details
+	 * 			Everything goes through one ring of \c slots fixed-size
+	 * 			slots, each holding a record view and room for its digest.
+	 * 			A slot's atomic state word steps through its lap as
+	 * 			<CODE>free -> filled -> hashed -> free</CODE>:
+	 * 			@li producers claim free slots with a compare-and-swap on the
+	 * 			head counter, so any number of threads may push;
+	 * 			@li workers take sequence numbers from their own counter and
+	 * 			hash into the slot's digest;
+	 * 			@li one consumer pops slots in sequence order, which frees
+	 * 			them for the next lap.
+	 *
+	 * 			No locks are taken, and nothing is allocated per record;
+	 * 			each worker keeps one arena for its whole life. A full ring
+	 * 			is the backpressure: \c push() waits, and \c tryPush() says
+	 * 			no, until the consumer catches up.
+	 *
+	 * 			Digests match \c hash() (so \c hashData128 / \c hashData256
+	 * 			for those variants). A record that \c hash() would refuse
+	 * 			completes with \c failed set rather than stopping the pool.
+	 *
+	 * @note
+	 * 			Only the record's view is queued: its bytes must stay put
+	 * 			until its completion is popped. \c pop() and \c tryPop() must
+	 * 			all come from one thread, and \c close() must only be called
+	 * 			once every producer is done.
+	 ********/
+	class RecordPipeline {
+	public:
+		//! Room for the longest digest of any variant
+		static constexpr ushort maxDigest = 96;
+
+		struct Completion {
+			uint64_t sequence, tag;
+			ushort size;
+			bool failed;
+			std::array<byte, maxDigest> digest;
+		};
+
+		explicit RecordPipeline(const Variant& v, uint workers = 1, size_t slots = 1024);
+		~RecordPipeline();
+		RecordPipeline(const RecordPipeline&) = delete;
+		RecordPipeline& operator=(const RecordPipeline&) = delete;
+
+		//! Queues a record and returns its sequence number, waiting while the ring is full
+		uint64_t push(const byte* data, size_t len, uint64_t tag = 0);
+		bool tryPush(const byte* data, size_t len, uint64_t tag = 0, uint64_t* sequence = nullptr);
+		//! Takes the next completion in order, waiting for it; false once closed and drained
+		bool pop(Completion& out);
+		bool tryPop(Completion& out);
+		//! Lets the pool drain and stop; \c pop() returns false after the last record
+		void close() noexcept;
+	private:
+		struct alignas(64) Slot {
+			std::atomic<uint64_t> state; //4 * sequence + 0 (free), 1 (filled) or 2 (hashed)
+			const byte* data;
+			size_t len;
+			uint64_t tag;
+			bool failed;
+			byte digest[maxDigest];
+		};
+		struct alignas(64) Counter {
+			std::atomic<uint64_t> value;
+		};
+
+		const Variant variant;
+		const uint64_t mask;
+		std::unique_ptr<Slot[]> ring;
+		Counter head, claimed;
+		std::atomic<bool> closed;
+		uint64_t tail; //consumer only
+		std::vector<std::thread> pool;
+
+		bool drained(uint64_t sequence) const noexcept;
+		void work();
+	};
+}
+}
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * nacha-sum.cpp  --> sha256sum-style file hashing with NACHA
+ * 
+ * Copyright (c) August 2021 Evan R. Clegern <evanclegern.work@gmail.com>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "nacha-file.hpp"
+#include "nacha-cache.hpp"
+#include "nacha-tree.hpp"
+#include "threading.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+
+using namespace ERCLIB;
+
+namespace {
+	struct Options {
+		const NACHA::Variant* variant = &NACHA::findVariant("256");
+		uint workers = Threading::defaultWorkers();
+		bool check = false, tree = false, tag = false;
+		size_t budget = 0;
+		std::vector<std::string> paths;
+		std::unique_ptr<NACHA::DigestCache> cache;
+	};
+	
+	//! One file to hash and print
+	struct Job {
+		std::string path;
+		std::string result, error;
+		bool done = false;
+	};
+	
+	void usage(std::ostream& os) {
+		os << "Usage: nacha-sum [-a VARIANT] [-j N] [--tree] [--tag] [--cache INDEX] [-c [--budget N]] [FILE]...\n"
+			<< "Print or check NACHA digests, one \"digest  path\" line per file.\n"
+			<< "With no FILE, or when FILE is -, read standard input.\n\n"
+			<< "  -a VARIANT  parameter set:";
+		for (const NACHA::Variant& v : NACHA::variants()) os << ' ' << v.name;
+		os << " (default 256)\n"
+			<< "  -j N        files hashed at once (default: one per core)\n"
+			<< "  --tree      NACHA Tree digest; works for files of any size\n"
+			<< "  --tag       print \"NACHA-VARIANT (path) = digest\" lines, which -c checks whatever -a says\n"
+			<< "  --cache INDEX  reuse digests of unchanged files from INDEX, and add new ones\n"
+			<< "  -c          read digests from the FILEs and check them\n"
+			<< "  --budget N  with -c, stop opening files after N have failed\n";
+	}
+	
+	std::string digestOf(const std::string& path, const Options& opt, std::vector<byte>& arena) {
+		const NACHA::Variant& v = *opt.variant;
+		if (path == "-") {
+			if (opt.tree) return NACHA::toHex(NACHA::treeHashFd(STDIN_FILENO, v));
+			return NACHA::toHex(NACHA::hashFd(STDIN_FILENO, v));
+		}
+		if (opt.tree) return NACHA::toHex(NACHA::treeHashFile(path, v, 1, opt.cache.get()));
+		return NACHA::toHex(NACHA::hashFile(path, v, arena, opt.cache.get()));
+	}
+	
+	//! A cache that cannot be written is reported, but every digest printed is still right
+	bool flushCache(const Options& opt) {
+		if (!opt.cache) return true;
+		try {
+			opt.cache->flush();
+			return true;
+		} catch (const std::exception& e) {
+			std::cerr << "nacha-sum: " << e.what() << '\n';
+			return false;
+		}
+	}
+	
+	/********!
+	 * @brief
+	 * 			Hashes every job on \c opt.workers threads, printing each
+	 * 			result as soon as every job before it has printed.
+	 * 
+	 * @details
+	 * 			Workers claim jobs from an atomic counter, each keeping its
+	 * 			own arena. Standard input is only read on the calling
+	 * 			thread's turn, so it is never read twice at once.
+	 ********/
+	template<class Print> void runJobs(std::vector<Job>& jobs, const Options& opt, Print&& print) {
+		std::atomic<size_t> next(0);
+		std::mutex outLock;
+		size_t printed = 0;
+		std::mutex stdinLock;
+		const uint workers = std::max<uint>(1, std::min<size_t>(opt.workers, jobs.size()));
+		Threading::forRange(workers, workers, [&](size_t, size_t, uint) {
+			std::vector<byte> arena;
+			for (size_t i = next++; i < jobs.size(); i = next++) {
+				Job& job = jobs[i];
+				try {
+					if (job.path == "-") {
+						std::lock_guard<std::mutex> L(stdinLock);
+						job.result = digestOf(job.path, opt, arena);
+					} else {
+						job.result = digestOf(job.path, opt, arena);
+					}
+				} catch (const std::exception& e) {
+					job.error = e.what();
+					if (job.error.compare(0, job.path.size() + 1, job.path + ":") != 0) job.error = job.path + ": " + job.error;
+				}
+				std::fill(arena.begin(), arena.end(), 0); //basic memory sanitation
+				std::lock_guard<std::mutex> L(outLock);
+				job.done = true;
+				while (printed < jobs.size() && jobs[printed].done) print(jobs[printed++]);
+			}
+		});
+	}
+}
+
+int main(int argc, char** argv) {
+	Options opt;
+	try {
+		for (int i = 1; i < argc; i++) {
+			const std::string arg = argv[i];
+			if (arg == "-h" || arg == "--help") {
+				usage(std::cout);
+				return 0;
+			} else if (arg == "-a" && i + 1 < argc) {
+				opt.variant = &NACHA::findVariant(argv[++i]);
+			} else if (arg == "-j" && i + 1 < argc) {
+				const long n = std::strtol(argv[++i], nullptr, 10);
+				if (n < 1) throw std::invalid_argument("-j needs a positive thread count!");
+				opt.workers = uint(n);
+			} else if (arg == "-c") {
+				opt.check = true;
+			} else if (arg == "--tree") {
+				opt.tree = true;
+			} else if (arg == "--tag") {
+				opt.tag = true;
+			} else if (arg == "--budget" && i + 1 < argc) {
+				const long n = std::strtol(argv[++i], nullptr, 10);
+				if (n < 1) throw std::invalid_argument("--budget needs a positive failure count!");
+				opt.budget = size_t(n);
+			} else if (arg == "--cache" && i + 1 < argc) {
+				opt.cache.reset(new NACHA::DigestCache(argv[++i]));
+			} else if (arg == "--") {
+				for (i++; i < argc; i++) opt.paths.push_back(argv[i]);
+			} else if (arg.size() > 1 && arg[0] == '-') {
+				throw std::invalid_argument("Unknown option '" + arg + "'!");
+			} else {
+				opt.paths.push_back(arg);
+			}
+		}
+	} catch (const std::exception& e) {
+		std::cerr << "nacha-sum: " << e.what() << '\n';
+		usage(std::cerr);
+		return 2;
+	}
+	if (opt.paths.empty()) opt.paths.push_back("-");
+	
+	int status = 0;
+	std::vector<Job> jobs;
+	if (!opt.check) {
+		for (const std::string& p : opt.paths) {
+			jobs.emplace_back();
+			jobs.back().path = p;
+		}
+		runJobs(jobs, opt, [&](const Job& job) {
+			if (!job.error.empty()) {
+				std::cerr << "nacha-sum: " << job.error << '\n';
+				status = 1;
+				return;
+			}
+			if (opt.tag) {
+				std::cout << NACHA::manifestLine(NACHA::ManifestEntry{job.path, opt.variant, opt.tree, NACHA::fromHex(job.result)}, true) << '\n';
+			} else {
+				std::cout << job.result << "  " << job.path << '\n';
+			}
+		});
+		return flushCache(opt) ? status : 1;
+	}
+	
+	size_t badLines = 0, failed = 0, unreadable = 0, skipped = 0;
+	std::vector<NACHA::ManifestEntry> manifest;
+	for (const std::string& list : opt.paths) {
+		std::ifstream file;
+		if (list != "-") {
+			file.open(list);
+			if (!file) {
+				std::cerr << "nacha-sum: " << list << ": cannot open: " << std::strerror(errno) << '\n';
+				status = 1;
+				continue;
+			}
+		}
+		std::istream& in = (list == "-") ? std::cin : file;
+		std::string line;
+		while (std::getline(in, line)) {
+			if (line.empty()) continue;
+			NACHA::ManifestEntry entry;
+			if (!NACHA::parseManifestLine(line, *opt.variant, opt.tree, entry)) {
+				badLines++;
+				continue;
+			}
+			manifest.push_back(entry);
+		}
+	}
+	NACHA::VerifyOptions verify;
+	verify.workers = opt.workers;
+	verify.failureBudget = opt.budget;
+	verify.cache = opt.cache.get();
+	NACHA::verifyManifest(manifest, verify, [&](size_t i, const NACHA::Verification& result) {
+		const std::string& path = manifest[i].path;
+		switch (result.verdict) {
+			case NACHA::Verdict::ok:
+				std::cout << path << ": OK\n";
+				break;
+			case NACHA::Verdict::mismatch:
+				std::cout << path << ": FAILED\n";
+				failed++;
+				break;
+			case NACHA::Verdict::unreadable:
+				std::cerr << "nacha-sum: " << result.error << '\n';
+				std::cout << path << ": FAILED open or read\n";
+				unreadable++;
+				break;
+			case NACHA::Verdict::skipped:
+				skipped++;
+				break;
+		}
+	});
+	if (badLines) std::cerr << "nacha-sum: WARNING: " << badLines << " line" << (badLines == 1 ? " is" : "s are") << " improperly formatted\n";
+	if (unreadable) std::cerr << "nacha-sum: WARNING: " << unreadable << " listed file" << (unreadable == 1 ? "" : "s") << " could not be read\n";
+	if (failed) std::cerr << "nacha-sum: WARNING: " << failed << " computed checksum" << (failed == 1 ? " did" : "s did") << " NOT match\n";
+	if (skipped) std::cerr << "nacha-sum: WARNING: " << skipped << " listed file" << (skipped == 1 ? " was" : "s were") << " not checked; the failure budget ran out\n";
+	if (badLines || unreadable || failed || skipped || manifest.empty()) status = 1;
+	return flushCache(opt) ? status : 1;
+}
@@ -0,0 +1,279 @@
+/*
+ * nacha-tree.cpp  --> Tree hashing mode for nacha.hpp
+ * 
+ * Copyright (c) August 2021 Evan R. Clegern <evanclegern.work@gmail.com>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "nacha-tree.hpp"
+#include "fileio.hpp"
+#include "bytes.hpp"
+#include "threading.hpp"
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ERCLIB {
+namespace NACHA {
+	namespace {
+		const byte leafTag = 0x00, nodeTag = 0x01, rootTag = 0x02;
+		const char indexMagic[8] = {'N','A','C','H','A','T','R','E'};
+		const uint32_t indexVersion = 1;
+		
+		/********!
+		 * @brief
+		 * 			The shortest leaf message (tag included) that \c hash()
+		 * 			cannot compress under these parameters, or 0 if every
+		 * 			length up to \c upTo is fine.
+		 * 
+		 * @details
+		 * 			The legacy length limit is not monotonic, so a leaf size
+		 * 			that works can still have shorter tails that throw. Each
+		 * 			parameter set is scanned once from the smallest leaf and
+		 * 			only extended when a larger leaf size asks for it.
+		 ********/
+		uint64_t firstBadLeaf(ushort capac, byte blkA, byte blkB, uint64_t upTo) {
+			struct Scan {uint64_t next, bad;};
+			static std::mutex lock;
+			static std::map<uint32_t, Scan> scans;
+			std::lock_guard<std::mutex> L(lock);
+			Scan& S = scans.emplace((uint32_t(capac) << 16) | (uint32_t(blkA) << 8) | blkB, Scan{2, 0}).first->second;
+			for (; S.bad == 0 && S.next <= upTo; S.next++) {
+				try {
+					HashPlan(size_t(S.next), capac, blkA, blkB);
+				} catch (const std::invalid_argument&) {
+					S.bad = S.next;
+				}
+			}
+			return (S.bad != 0 && S.bad <= upTo) ? S.bad : 0;
+		}
+		
+		uint64_t fdSize(int fd) {
+			struct stat st;
+			if (::fstat(fd, &st) != 0) throw std::runtime_error(std::string("NACHA tree could not stat its input: ") + std::strerror(errno));
+			return uint64_t(st.st_size);
+		}
+		
+		//! Runs \c fn over \c items on \c workers threads, rethrowing the first failure once all are joined
+		template<class F> void forItems(const std::vector<size_t>& items, uint workers, F&& fn) {
+			std::vector<std::exception_ptr> failed(std::max(workers, 1u));
+			Threading::forRange(items.size(), workers, [&](size_t first, size_t last, uint t) {
+				try {
+					fn(items.data() + first, items.data() + last);
+				} catch (...) {
+					failed[t] = std::current_exception();
+				}
+			});
+			for (std::exception_ptr& i : failed) if (i) std::rethrow_exception(i);
+		}
+	}
+	
+	TreeIndex::TreeIndex(ushort _capac, byte _blkA, byte _blkB, uint64_t _leafSize) : capac(_capac), blkA(_blkA), blkB(_blkB), leafSize(_leafSize), total(0) {
+		if (_leafSize == 0) throw std::invalid_argument("NACHA tree leaves must hold at least one byte!");
+		//These throw if a node (or the root) is past what hash() can compress, or the parameters are bad
+		HashPlan((2 * size_t(_capac)) + 1, _capac, _blkA, _blkB);
+		HashPlan(size_t(_capac) + 17, _capac, _blkA, _blkB);
+		//The last leaf can be any length up to leafSize, so every one of them has to hash
+		const uint64_t bad = firstBadLeaf(_capac, _blkA, _blkB, _leafSize + 1);
+		if (bad != 0) throw std::invalid_argument("NACHA cannot hash a " + std::to_string(bad - 1) + "-byte tree leaf with these parameters; use a leaf size below it!");
+	}
+	
+	//! Leaves that overlap \c dirty, plus every leaf from the old end of input on if the size moved
+	std::vector<size_t> TreeIndex::dirtyLeaves(uint64_t size, const std::vector<TreeRange>& dirty) const {
+		std::vector<size_t> out;
+		for (const TreeRange& i : dirty) {
+			if (i.length == 0 || i.offset >= size) continue;
+			const uint64_t end = std::min(size, i.offset + i.length);
+			for (uint64_t L = i.offset / this->leafSize; L <= (end - 1) / this->leafSize; L++) out.push_back(size_t(L));
+		}
+		if (size != this->total || this->levels.empty()) {
+			const uint64_t leaves = size ? ((size + this->leafSize - 1) / this->leafSize) : 1;
+			for (uint64_t L = std::min(size, this->total) / this->leafSize; L < leaves; L++) out.push_back(size_t(L));
+		}
+		return out;
+	}
+	
+	/********!
+	 * @brief
+	 * 			Rehashes \c dirtyLeaves, then every node above them, for an
+	 * 			input of \c size bytes read through \c read.
+	 * 
+	 * @details
+	 * 			A level whose node count changed also marks everything past
+	 * 			the old end as dirty, since pairings (and the carried odd
+	 * 			node) shift there. Levels above the new top are dropped.
+	 ********/
+	void TreeIndex::rebuild(const Reader& read, uint64_t size, std::vector<size_t> dirty, uint workers) {
+		const size_t leaves = size ? size_t((size + this->leafSize - 1) / this->leafSize) : 1;
+		size_t oldCount = this->leafCount();
+		if (this->levels.empty()) this->levels.emplace_back();
+		this->levels[0].resize(leaves * this->capac);
+		
+		std::sort(dirty.begin(), dirty.end());
+		dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+		dirty.erase(std::lower_bound(dirty.begin(), dirty.end(), leaves), dirty.end());
+		
+		forItems(dirty, workers, [&](const size_t* first, const size_t* last) {
+			std::vector<byte> buf(size_t(this->leafSize) + 1), arena;
+			buf[0] = leafTag;
+			const HashPlan full(size_t(this->leafSize) + 1, this->capac, this->blkA, this->blkB);
+			for (; first != last; first++) {
+				const uint64_t at = *first * this->leafSize;
+				const size_t len = size_t(std::min(this->leafSize, size - std::min(size, at)));
+				read(at, len, buf.data() + 1);
+				byte* out = this->levels[0].data() + (*first * this->capac);
+				if (len == this->leafSize) hash(full, buf.data(), arena, out);
+				else hash(HashPlan(len + 1, this->capac, this->blkA, this->blkB), buf.data(), arena, out);
+			}
+			std::fill(buf.begin(), buf.end(), 0); //basic memory sanitation
+		});
+		
+		size_t k = 0, count = leaves;
+		while (count > 1) {
+			const size_t parents = (count + 1) / 2;
+			const size_t oldParents = (k + 1 < this->levels.size()) ? (this->levels[k + 1].size() / this->capac) : 0;
+			std::vector<size_t> up;
+			for (size_t i : dirty) up.push_back(i / 2);
+			if (count != oldCount) {
+				const size_t keep = std::min(count, oldCount);
+				for (size_t i = keep ? ((keep - 1) / 2) : 0; i < parents; i++) up.push_back(i);
+			}
+			std::sort(up.begin(), up.end());
+			up.erase(std::unique(up.begin(), up.end()), up.end());
+			
+			if (k + 1 >= this->levels.size()) this->levels.emplace_back();
+			this->levels[k + 1].resize(parents * this->capac);
+			const byte* child = this->levels[k].data();
+			byte* parent = this->levels[k + 1].data();
+			forItems(up, workers, [&](const size_t* first, const size_t* last) {
+				std::vector<byte> buf((2 * size_t(this->capac)) + 1), arena;
+				buf[0] = nodeTag;
+				const HashPlan plan(buf.size(), this->capac, this->blkA, this->blkB);
+				for (; first != last; first++) {
+					const size_t j = *first;
+					if ((2 * j) + 1 < count) {
+						std::memcpy(buf.data() + 1, child + (2 * j * this->capac), 2 * size_t(this->capac));
+						hash(plan, buf.data(), arena, parent + (j * this->capac));
+					} else {
+						std::memcpy(parent + (j * this->capac), child + (2 * j * this->capac), this->capac); //odd node out
+					}
+				}
+			});
+			dirty.swap(up);
+			oldCount = oldParents;
+			count = parents;
+			k++;
+		}
+		this->levels.resize(k + 1);
+		this->total = size;
+	}
+	
+	void TreeIndex::build(const byte* data, uint64_t size, uint workers) {
+		this->levels.clear(); this->total = 0;
+		this->update(data, size, {}, workers);
+	}
+	void TreeIndex::build(int fd, uint workers) {
+		this->levels.clear(); this->total = 0;
+		this->update(fd, {}, workers);
+	}
+	void TreeIndex::update(const byte* data, uint64_t size, const std::vector<TreeRange>& dirty, uint workers) {
+		this->rebuild([data](uint64_t offset, size_t len, byte* dst) {std::memcpy(dst, data + offset, len);}, size, this->dirtyLeaves(size, dirty), workers);
+	}
+	void TreeIndex::update(int fd, const std::vector<TreeRange>& dirty, uint workers) {
+		const uint64_t size = fdSize(fd);
+		this->rebuild([fd](uint64_t offset, size_t len, byte* dst) {FileIO::preadAll(fd, offset, len, dst);}, size, this->dirtyLeaves(size, dirty), workers);
+	}
+	
+	std::vector<byte> TreeIndex::root() const {
+		if (this->levels.empty()) throw std::logic_error("NACHA tree has not been built yet!");
+		std::vector<byte> buf(1 + this->capac + 16);
+		buf[0] = rootTag;
+		std::memcpy(buf.data() + 1, this->levels.back().data(), this->capac);
+		Bytes::putLE(buf.data() + 1 + this->capac, this->total, 8);
+		Bytes::putLE(buf.data() + 9 + this->capac, this->leafSize, 8);
+		return hash(buf, this->capac, this->blkA, this->blkB);
+	}
+	
+	/********!
+	 * @brief
+	 * 			Writes the index to \c path.
+	 * 
+	 * @details
+	 * 			Layout, little-endian: "NACHATRE", version (4), capacity (2),
+	 * 			block A (1), block B (1), leaf size (8), input size (8), level
+	 * 			count (4), then each level's digests from the leaves up. Node
+	 * 			counts follow from the input and leaf sizes.
+	 ********/
+	void TreeIndex::save(const std::string& path) const {
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		byte head[36];
+		std::memcpy(head, indexMagic, 8);
+		Bytes::putLE(head + 8, indexVersion, 4);
+		Bytes::putLE(head + 12, this->capac, 2);
+		head[14] = this->blkA; head[15] = this->blkB;
+		Bytes::putLE(head + 16, this->leafSize, 8);
+		Bytes::putLE(head + 24, this->total, 8);
+		Bytes::putLE(head + 32, this->levels.size(), 4);
+		file.write(reinterpret_cast<const char*>(head), sizeof(head));
+		for (const std::vector<byte>& i : this->levels) file.write(reinterpret_cast<const char*>(i.data()), std::streamsize(i.size()));
+		file.close();
+		if (!file) throw std::runtime_error("NACHA tree index could not be written to " + path);
+	}
+	TreeIndex TreeIndex::load(const std::string& path) {
+		std::ifstream file(path, std::ios::binary);
+		byte head[36];
+		if (!file.read(reinterpret_cast<char*>(head), sizeof(head)) || std::memcmp(head, indexMagic, 8) != 0) throw std::runtime_error("Not a NACHA tree index: " + path);
+		if (Bytes::getLE(head + 8, 4) != indexVersion) throw std::runtime_error("Unsupported NACHA tree index version: " + path);
+		TreeIndex T(ushort(Bytes::getLE(head + 12, 2)), head[14], head[15], Bytes::getLE(head + 16, 8));
+		T.total = Bytes::getLE(head + 24, 8);
+		const uint64_t depth = Bytes::getLE(head + 32, 4);
+		
+		//Every count here comes from the file, so they must add up to what is left of it before anything is allocated
+		const std::streamoff at = file.tellg();
+		file.seekg(0, std::ios::end);
+		const uint64_t rest = uint64_t(file.tellg() - at), budget = rest / T.capac;
+		file.seekg(at);
+		uint64_t count = T.total ? (((T.total - 1) / T.leafSize) + 1) : 1, nodes = 0, levels = 0;
+		for (uint64_t c = count; ; c = (c + 1) / 2) {
+			if (c > budget - nodes) throw std::runtime_error("NACHA tree index is truncated: " + path);
+			nodes += c;
+			levels++;
+			if (c == 1) break;
+		}
+		if (levels != depth || nodes * T.capac != rest) throw std::runtime_error("NACHA tree index is malformed: " + path);
+		
+		for (uint64_t k = 0; k < depth; k++) {
+			T.levels.emplace_back(size_t(count) * T.capac);
+			if (!file.read(reinterpret_cast<char*>(T.levels.back().data()), std::streamsize(T.levels.back().size()))) throw std::runtime_error("NACHA tree index is truncated: " + path);
+			count = (count + 1) / 2;
+		}
+		return T;
+	}
+	
+	//! One-shot tree digest of an in-memory buffer
+	std::vector<byte> treeHash(const byte* data, uint64_t size, const ushort _capac, const byte _blkA, const byte _blkB, uint64_t leafSize, uint workers) {
+		TreeIndex T(_capac, _blkA, _blkB, leafSize);
+		T.build(data, size, workers);
+		return T.root();
+	}
+}
+}
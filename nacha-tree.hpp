@@ -0,0 +1,64 @@
+#ifndef erclib_nacha_tree_included
+#define erclib_nacha_tree_included
+
+#include "nacha.hpp"
+#include <cstdint>
+#include <functional>
+
+namespace ERCLIB {
+namespace NACHA {
+	//! Byte range of a file or buffer that has been modified since the last hash
+	struct TreeRange {
+		uint64_t offset, length;
+	};
+
+	/********!
+	 * @brief
+	 * 			NACHA Tree mode: a separate digest for inputs too large to
+	 * 			hold in memory, and for rehashing only what changed.
+	 *
+	 * @details
+	 * 			@li The input is cut into \c leafSize leaves (the last may be
+	 * 			short; an empty input is one empty leaf). Each leaf's digest
+	 * 			is NACHA of <CODE>0x00 || leaf</CODE>.
+	 *
+	 * 			@li Each level pairs its nodes as NACHA of <CODE>0x01 || left
+	 * 			|| right</CODE>; an odd node out is carried up unchanged.
+	 *
+	 * 			@li The root is NACHA of <CODE>0x02 || top || size || leafSize</CODE>,
+	 * 			both lengths as 64-bit little-endian values.
+	 *
+	 * 			Every level is kept, so \c update() only rehashes the dirty
+	 * 			leaves and their paths to the top, and \c save() / \c load()
+	 * 			carry the whole index between runs.
+	 ********/
+	class TreeIndex {
+		ushort capac;
+		byte blkA, blkB;
+		uint64_t leafSize, total;
+		std::vector<std::vector<byte>> levels; //levels[0] holds the leaf digests, each _capac bytes
+
+		TreeIndex() = default;
+		void rebuild(const Reader& read, uint64_t size, std::vector<size_t> dirtyLeaves, uint workers);
+		std::vector<size_t> dirtyLeaves(uint64_t size, const std::vector<TreeRange>& dirty) const;
+	public:
+		explicit TreeIndex(ushort _capac, byte _blkA, byte _blkB, uint64_t _leafSize = 16384);
+
+		void build(const byte* data, uint64_t size, uint workers = 1);
+		void build(int fd, uint workers = 1);
+		void update(const byte* data, uint64_t size, const std::vector<TreeRange>& dirty, uint workers = 1);
+		void update(int fd, const std::vector<TreeRange>& dirty, uint workers = 1);
+
+		std::vector<byte> root() const;
+		uint64_t size() const noexcept {return this->total;};
+		size_t leafCount() const noexcept {return this->levels.empty() ? 0 : (this->levels[0].size() / this->capac);};
+
+		void save(const std::string& path) const;
+		static TreeIndex load(const std::string& path);
+	};
+
+	extern std::vector<byte> treeHash(const byte* data, uint64_t size, const ushort _capac, const byte _blkA, const byte _blkB, uint64_t leafSize = 16384, uint workers = 1);
+}
+}
+
+#endif
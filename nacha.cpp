@@ -25,6 +25,19 @@
  */
 
 #include "nacha.hpp"
+#include "bytes.hpp"
+#include "threading.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 /********!
  * @bug Segmentation errors with permuteA
  *  		Solution was that all of our 'Underflow' calculations were
@@ -38,6 +51,242 @@
 namespace ERCLIB {
 namespace NACHA {
 	namespace low {
+		namespace {
+			const byte padA[4] = {0xDE, 0xAD, 0xBE, 0xEF};
+			const byte padB[4] = {0xFE, 0xED, 0xC0, 0xDE};
+			const byte padM[3] = {0xCA, 0xBE, 0xDF};
+			//! Reads \c len bytes starting at \c base, running into the repeating \c pad once past \c Size
+			inline void loadChunk(const byte* Input, size_t Size, size_t base, byte len, const byte* pad, byte padLen, byte* dst) {
+				for (byte i = 0; i < len; i++) {
+					const size_t at = base + i;
+					dst[i] = (at < Size) ? Input[at] : pad[(at - Size) % padLen];
+				}
+			}
+			
+			//! Chunks in permuteA/B are read from ((c * 8) % 256), so only the first 32 are distinct
+			const size_t permuteSpan = 32;
+			
+			inline uint64_t load64(const byte* p) {
+				uint64_t x = 0;
+				for (byte i = 0; i < 8; i++) x |= uint64_t(p[i]) << (8 * i);
+				return x;
+			}
+			inline void store64(byte* p, uint64_t x) {
+				for (byte i = 0; i < 8; i++) p[i] = byte(x >> (8 * i));
+			}
+			/********!
+			 * @brief
+			 * 			Transposes \c chunks consecutive 8x8 bit matrices, so
+			 * 			that bit B of byte i becomes bit i of byte B.
+			 * 
+			 * @details
+			 * 			The vector paths gather one bit-plane per movemask (the
+			 * 			top bit of every byte), shifting the next plane up each
+			 * 			time; the scalar path is the usual three-step swap of
+			 * 			2x2, 4x4 and 8x8 blocks inside a 64-bit word.
+			 ********/
+			inline void transposeChunks(const byte* src, size_t chunks, byte* out) {
+				size_t c = 0;
+#if defined(__AVX2__)
+				for (; c + 4 <= chunks; c += 4) {
+					__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + (c * 8)));
+					for (int B = 7; B >= 0; B--) {
+						const uint32_t m = uint32_t(_mm256_movemask_epi8(v));
+						out[(c * 8) + B] = byte(m);
+						out[(c * 8) + 8 + B] = byte(m >> 8);
+						out[(c * 8) + 16 + B] = byte(m >> 16);
+						out[(c * 8) + 24 + B] = byte(m >> 24);
+						v = _mm256_slli_epi64(v, 1);
+					}
+				}
+#endif
+#if defined(__SSE2__)
+				for (; c + 2 <= chunks; c += 2) {
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (c * 8)));
+					for (int B = 7; B >= 0; B--) {
+						const uint32_t m = uint32_t(_mm_movemask_epi8(v));
+						out[(c * 8) + B] = byte(m);
+						out[(c * 8) + 8 + B] = byte(m >> 8);
+						v = _mm_slli_epi64(v, 1);
+					}
+				}
+#endif
+				for (; c < chunks; c++) {
+					uint64_t x = load64(src + (c * 8)), t;
+					t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL; x ^= t ^ (t << 7);
+					t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL; x ^= t ^ (t << 14);
+					t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL; x ^= t ^ (t << 28);
+					store64(out + (c * 8), x);
+				}
+			}
+			/********!
+			 * @brief
+			 * 			Shared body of permuteA and permuteB: transposes every
+			 * 			distinct chunk of the padded input once, then repeats
+			 * 			the first 32 for the rest of the output. With \c wide
+			 * 			(NACHA-L), every chunk is distinct and nothing repeats.
+			 * 
+			 * @details
+			 * 			For permuteB, \c rotate turns byte B of every chunk right
+			 * 			by B, before the repeat. The transpose leaves bit i in
+			 * 			place i and permuteB wants it at (i - B) mod 8; a whole
+			 * 			chunk does this in three steps, rotating by 1, 2 and 4
+			 * 			every byte whose index has that bit set.
+			 * 
+			 * @returns
+			 * 			Padded size, a multiple of eight.
+			 ********/
+			inline size_t transposeInput(const byte* Input, size_t Size, const byte* pad, byte* Out, bool rotate, bool wide) {
+				const size_t nsize = ((Size / 8) + 1) * 8, chunks = nsize / 8;
+				const size_t span = wide ? chunks : permuteSpan;
+				const size_t distinct = std::min(chunks, span);
+				const size_t direct = std::min(distinct, Size / 8);
+				transposeChunks(Input, direct, Out);
+				if (direct < distinct) {
+					//Only the last chunk ever runs into the padding
+					byte src[8];
+					loadChunk(Input, Size, direct * 8, 8, pad, 4, src);
+					transposeChunks(src, 1, Out + (direct * 8));
+				}
+				for (size_t c = 0; rotate && c < distinct * 8; c += 8) {
+					uint64_t x = load64(Out + c);
+					x = (x & 0x00FF00FF00FF00FFULL) | ((((x >> 1) & 0x7F7F7F7F7F7F7F7FULL) | ((x << 7) & 0x8080808080808080ULL)) & 0xFF00FF00FF00FF00ULL);
+					x = (x & 0x0000FFFF0000FFFFULL) | ((((x >> 2) & 0x3F3F3F3F3F3F3F3FULL) | ((x << 6) & 0xC0C0C0C0C0C0C0C0ULL)) & 0xFFFF0000FFFF0000ULL);
+					x = (x & 0x00000000FFFFFFFFULL) | ((((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x << 4) & 0xF0F0F0F0F0F0F0F0ULL)) & 0xFFFFFFFF00000000ULL);
+					store64(Out + c, x);
+				}
+				for (size_t at = span * 8; at < nsize; at += span * 8) {
+					std::memcpy(Out + at, Out, std::min(span * 8, nsize - at));
+				}
+				return nsize;
+			}
+			
+			/********!
+			 * @brief
+			 * 			Lookup tables for mix(), indexed by [form][byte in block]
+			 * 			[low bit][index parity][input byte].
+			 * 
+			 * @details
+			 * 			mix() only ever looks at the low bit of each (chained)
+			 * 			block byte, and where that bit lands depends on nothing
+			 * 			but the byte's place in the block of five and on \c form.
+			 * 			That leaves two possible first-pass bytes per place, so
+			 * 			the second, per-byte affine pass can be folded straight
+			 * 			into the table as well.
+			 ********/
+			struct MixTables {
+				byte pass[2][5][2][2][256];
+			};
+			constexpr MixTables buildMixTables() {
+				MixTables T{};
+				for (byte form = 0; form < 2; form++) {
+					for (byte i = 0; i < 5; i++) {
+						for (byte bit = 0; bit < 2; bit++) {
+							//First pass, as the original bit loop ran it: 'pnt' is always set at a byte's start
+							byte chunk = 0, bind = 4 * i; bool pnt = 1;
+							for (byte B = 0; B < 8; B++) {
+								byte J = bit;
+								if (pnt) {
+									if (form) J = byte(~uint(J) << bind); else J <<= bind;
+								} else {
+									J <<= bind + 3; bind++;
+								}
+								pnt = !pnt;
+								chunk ^= J;
+							}
+							const byte o = (i & 1) ? byte(~chunk) : byte(chunk + form);
+							//Second pass
+							for (byte odd = 0; odd < 2; odd++) {
+								for (uint t = 0; t < 256; t++) {
+									byte J = (t ^ ~o) ^ ((o << 3) | (o >> 5));
+									if (odd) {J ^= (((t >> 2) * o) + ((t + o) >> 3)) % 256;} //affine ciphering
+									if (form) {J ^= (~o >> 3) | (o << 5);}
+									T.pass[form][i][bit][odd][t] = J;
+								}
+							}
+						}
+					}
+				}
+				return T;
+			}
+			constexpr MixTables mixTables = buildMixTables();
+			
+			//! permuteC's closing affine step, per byte, for either toggle state
+			struct ShrinkTable {
+				byte out[2][256];
+			};
+			constexpr ShrinkTable buildShrinkTable() {
+				ShrinkTable T{};
+				for (int i = 0; i < 256; i++) {
+					T.out[1][i] = byte(((i * (~i >> 4)) % 256) ^ i);
+					T.out[0][i] = byte((((i * (i >> 3)) + (~i >> 5)) % 256 ) ^ i);
+				}
+				return T;
+			}
+			constexpr ShrinkTable shrinkTable = buildShrinkTable();
+			
+			/********!
+			 * @brief
+			 * 			Tables that depend on nothing but the capacity, so they
+			 * 			are built once per \c _capac and then reused.
+			 * 
+			 * @details
+			 * 			@li \c fold is intertwine's index reduction for every
+			 * 			possible (i + (a ^ b)), which was a subtraction loop.
+			 * 
+			 * 			@li \c affine holds hash()'s final semi-affine vector for
+			 * 			each of the 256 possible trailing XOR values, one row each.
+			 * 
+			 * @note
+			 * 			Only capacities up to \c cachedCapacity are kept; larger ones
+			 * 			are rebuilt into a per-thread spare whenever the capacity changes.
+			 ********/
+			struct CapacityTables {
+				std::vector<ushort> fold;
+				std::vector<byte> affine;
+			};
+			const ushort cachedCapacity = 1024;
+			
+			void buildCapacityTables(ushort _capac, CapacityTables& T) {
+				if (_capac < 2) throw std::invalid_argument("Capacity provided to NACHA must be at least two bytes!");
+				T.fold.resize(_capac + 255);
+				for (uint v = 0; v < T.fold.size(); v++) {
+					ushort ind = v; while (ind >= _capac) {ind -= _capac / 2;}
+					T.fold[v] = ind;
+				}
+				T.affine.resize(256 * size_t(_capac));
+				for (uint lastxor = 0; lastxor < 256; lastxor++) {
+					for (ushort i =0; i < _capac; i++) {
+						//Semi-Affine method
+						byte N = i % 256;
+						T.affine[(lastxor * _capac) + i] = ((N + lastxor) * (N + (i ^ _capac))) % 256;
+					}
+				}
+			}
+			const CapacityTables& capacityTables(ushort _capac) {
+				//Each hash looks these up twice, so the last capacity a thread used skips the shared lock
+				thread_local ushort lastCapac = 0;
+				thread_local const CapacityTables* last = nullptr;
+				if (_capac == lastCapac) return *last;
+				if (_capac > cachedCapacity) {
+					thread_local CapacityTables spare;
+					buildCapacityTables(_capac, spare);
+					lastCapac = _capac; last = &spare;
+					return spare;
+				}
+				static std::mutex lock;
+				static std::map<ushort, CapacityTables> cache;
+				std::lock_guard<std::mutex> guard(lock);
+				auto found = cache.find(_capac);
+				if (found == cache.end()) {
+					CapacityTables T;
+					buildCapacityTables(_capac, T);
+					found = cache.emplace(_capac, std::move(T)).first;
+				}
+				lastCapac = _capac; last = &found->second;
+				return found->second; //map nodes never move, and entries are never erased
+			}
+		}
 		/********!
 		 * @brief
 		 * 			Permutation 'A' function, which effectively will
@@ -73,66 +322,33 @@ namespace NACHA {
 		 * 			If \c Input is empty, then there is no point in
 		 * 			attempting to permute the filler bytes.
 		 ********/
-		inline std::vector<byte> permuteA(const std::vector<byte> &Input) {
-			const byte Underflow = 8 - (Input.size() % 8);
-			std::vector<byte> tmp = Input;
-			if (Underflow > 0) {
-				std::vector<byte> append = {0xDE, 0xAD, 0xBE, 0xEF};
-				byte cnt=0, app = 0;
-				while (cnt < Underflow) {
-					tmp.push_back(append[app]);
-					if (app == 3) {app = 0;} else {app++;}
-					cnt++;
-				}
-				cnt ^= cnt;
-				app ^= app;
-			} else if (tmp.size() == 0) {
-				throw std::invalid_argument("No data provided to permuteA!");
-			}
-			uint nsize = tmp.size();
-
-			std::vector<byte> out;
-			//This loop: chunks per padded input
+		size_t permuteA(const byte* Input, size_t Size, byte* Out, bool wide) {
+			const size_t nsize = transposeInput(Input, Size, padA, Out, false, wide);
+			const size_t chunks = nsize / 8, span = wide ? chunks : permuteSpan;
 			
-			byte totXOR = 0;
-			for (uint c = 0; c < (nsize / 8); c++) {
-				byte IND = (c * 8) % 256;
-				std::vector<byte> chunk(8, 0);
-				//This loop: bytes per chunk
-				for (byte i=0;i<8;i++) {
-					byte n = tmp[IND + i];
-					totXOR ^= n;
-					//This loop: bits per byte
-					for (byte B = 0; B < 8; B++) {
-						bool bit = (n) & 1;
-						n >>= 1;
-						byte J = byte(0 + bit) << i;
-						chunk[B] |= J;
-						J ^= J;
-					}
-					n ^= n;
-				}
-				IND ^= IND;
-				//This loop: move chunk to output
-				for (byte i : chunk) {
-					out.push_back(i);
-				}
+			//Every byte read goes into totXOR, and chunks repeat every 32, so only an odd count of each matters
+			uint64_t lanes = 0;
+			for (size_t c = 0; c < std::min(chunks, span); c++) {
+				if (!(((chunks - c + span - 1) / span) & 1)) continue;
+				if ((c * 8) + 8 <= Size) {lanes ^= load64(Input + (c * 8)); continue;}
+				byte src[8];
+				loadChunk(Input, Size, c * 8, 8, padA, 4, src);
+				lanes ^= load64(src);
 			}
-			tmp.clear();
+			lanes ^= lanes >> 32; lanes ^= lanes >> 16; lanes ^= lanes >> 8;
+			const byte totXOR = byte(lanes);
 			// This XORs each output byte to the 'inverse position' byte in the permuted "arch."
 			// Ensure that, for larger inputs, their input chunks will not match up at all with their permuted chunks.
 			// And if it's a smaller input, it'll at least occur in a different order.
-			nsize = out.size();
-			for (uint i=0; i < nsize - 1; i++) {
-				uint ind = (nsize - 1) - i;
-				if (ind >= nsize) {ind = (nsize - 1);}
-				byte n = out.at(ind), j = out.at(i);
-				
-				out.push_back( ((n >> 4) | (j << 4)) ^ (~(j & n) ^ totXOR) );
-				n ^= n;
-				j ^= j;
+			for (size_t i=0; i < nsize - 1; i++) {
+				byte n = Out[(nsize - 1) - i], j = Out[i];
+				Out[nsize + i] = ((n >> 4) | (j << 4)) ^ (~(j & n) ^ totXOR);
 			}
-			totXOR ^= totXOR;
+			return (nsize * 2) - 1;
+		}
+		std::vector<byte> permuteA(const std::vector<byte> &Input) {
+			std::vector<byte> out(permuteASize(Input.size()));
+			permuteA(Input.data(), Input.size(), out.data());
 			return out;
 		}
 		
@@ -174,50 +390,13 @@ namespace NACHA {
 		 * 			If \c Input is empty, then there is no point in
 		 * 			attempting to permute the filler bytes.
 		 ********/
-		inline std::vector<byte> permuteB(const std::vector<byte> &Input) {
-			const byte Underflow = 8 - (Input.size() % 8);
-			std::vector<byte> tmp = Input;
+		size_t permuteB(const byte* Input, size_t Size, byte* Out, bool wide) {
 			//instead of appending 'DEADBEEF', we append 'FEEDC0DE'
-			if (Underflow > 0) {
-				std::vector<byte> append = {0xFE, 0xED, 0xC0, 0xDE};
-				byte cnt=0, app = 0;
-				while (cnt < Underflow) {
-					tmp.push_back(append[app]);
-					if (app == 3) {app = 0;} else {app++;}
-					cnt++;
-				}
-				cnt ^= cnt;
-				app ^= app;
-			} else if (tmp.size() == 0) {
-				throw std::invalid_argument("No data provided to permuteB!");
-			}
-			const uint nsize = tmp.size();
-			std::vector<byte> out;
-			//This loop: chunks per input
-			for (uint c = 0; c < (nsize / 8); c++) {
-				const byte IND = (c * 8) % 256;
-				std::vector<byte> chunk(8, 0);
-				//This loop: bytes per chunk
-				for (byte i=0;i<8;i++) {
-					byte n = tmp[IND + i];
-					//This loop: bits per byte
-					for (byte B = 0; B < 8; B++) {
-						bool bit = n & 1;
-						char val = i - B;
-						if (val < 0) val += 8;
-						n >>= 1;
-						chunk[B] |= (0 + bit) << val;
-						val ^= val;
-					}
-					n ^= n;
-				}
-				//This loop: move chunk to output
-				for (byte& i : chunk) {
-					out.push_back(i);
-					i ^= i;
-				}
-			}
-			tmp.clear();
+			return transposeInput(Input, Size, padB, Out, true, wide);
+		}
+		std::vector<byte> permuteB(const std::vector<byte> &Input) {
+			std::vector<byte> out(permuteBSize(Input.size()));
+			permuteB(Input.data(), Input.size(), out.data());
 			return out;
 		}
 		
@@ -261,40 +440,63 @@ namespace NACHA {
 		 * 			If \c Input is empty, then there is no point in
 		 * 			attempting to permute the filler bytes.
 		 ********/
-		inline std::vector<byte> permuteC(const std::vector<byte> &Input) {
+		size_t permuteC(const byte* Input, size_t Size, byte* Out, byte* Scratch, bool wide) {
 			//! This permute function adapts 'B' and then performs XORs to shrink it down without regard to divisibility.
-			std::vector<byte> Permuted = permuteB(Input);
-			uint size = Permuted.size();
-			if (size & 1) { //Must be divisible by 2; add 255 if it is odd
-				Permuted.push_back(0xFF); size++;
-			}
-			std::vector<byte> outa;
-			bool N = 0;
-			for (uint i = 0; i < (size / 2); i++) { //PermutedB will make it divisible by 2
-				byte t = Permuted[i], j = Permuted[(size / 2) - i];
-				if (N) {
-					outa.push_back( (t >> 4) ^ (j << 4) ^ (t & ~j) );
-				} else {
-					outa.push_back( (t >> 3) ^ (j << 5) ^ (~t & j) );
-				}
-				N = !N;
-				t ^= t;
-				j ^= j;
-			}
-			Permuted.clear();
-			std::vector<byte> out;
-			for (byte& i : outa) {
-				if (N) {
-					out.push_back( ((i * (~i >> 4)) % 256) ^ i);
-				} else {
-					out.push_back( (((i * (i >> 3)) + (~i >> 5)) % 256 ) ^ i);
-				}
-				N = !N;
-				i ^= i;
+			//! \c Scratch holds the 'B' permutation, so it must fit permuteBSize(Size) bytes.
+			const size_t size = permuteB(Input, Size, Scratch, wide); //always a multiple of eight, so never odd
+			const size_t half = size / 2;
+			//The toggle N runs through both passes, but half is a multiple of four, so in each it is just (i & 1)
+			for (size_t i = 0; i < half; i += 2) {
+				byte t = Scratch[i], j = Scratch[half - i];
+				Out[i] = shrinkTable.out[0][byte((t >> 3) ^ (j << 5) ^ (~t & j))];
+				t = Scratch[i + 1]; j = Scratch[half - i - 1];
+				Out[i + 1] = shrinkTable.out[1][byte((t >> 4) ^ (j << 4) ^ (t & ~j))];
 			}
-			outa.clear();
+			return half;
+		}
+		std::vector<byte> permuteC(const std::vector<byte> &Input) {
+			std::vector<byte> scratch(permuteBSize(Input.size()));
+			std::vector<byte> out(permuteCSize(Input.size()));
+			permuteC(Input.data(), Input.size(), out.data(), scratch.data());
 			return out;
 		}
+		namespace {
+			//! mix() over blocks [first, last) only; blocks are independent, so ranges can run side by side.
+			//! Each block takes its chain from the bytes at ((c * 5) % 256), or from itself if \c wide.
+			void mixBlocks(const byte* Input, size_t Size, bool form, byte* Out, size_t first, size_t last, bool wide = false) {
+				//! Each block byte XORs in the inverse of the one before it, so only a chain of low bits matters.
+				const size_t sz = mixSize(Size) + 1;
+				const byte lastInit = (sz - 1 < Size) ? Input[sz - 1] : padM[(sz - 1 - Size) % 3];
+				const auto& table = mixTables.pass[form];
+				byte srcTmp[5], inTmp[5];
+				for (size_t c = first; c < last; c++) {
+					const size_t IND = wide ? (c * 5) : ((c * 5) % 256);
+					const byte* src = Input + IND;
+					if (IND + 5 > Size) {loadChunk(Input, Size, IND, 5, padM, 3, srcTmp); src = srcTmp;}
+					const byte* in = Input + (c * 5);
+					if ((c * 5) + 5 > Size) {loadChunk(Input, Size, c * 5, 5, padM, 3, inTmp); in = inTmp;}
+					
+					bool bit = lastInit & 1;
+					if ((c * 5) + 5 < sz) {
+						//Every block but the last one is whole; its parities alternate from (c & 1)
+						byte* const o = Out + (c * 5);
+						const bool odd = c & 1;
+						bit = (src[0] & 1) ^ !bit; o[0] = table[0][bit][odd][in[0]];
+						bit = (src[1] & 1) ^ !bit; o[1] = table[1][bit][!odd][in[1]];
+						bit = (src[2] & 1) ^ !bit; o[2] = table[2][bit][odd][in[2]];
+						bit = (src[3] & 1) ^ !bit; o[3] = table[3][bit][!odd][in[3]];
+						bit = (src[4] & 1) ^ !bit; o[4] = table[4][bit][odd][in[4]];
+						continue;
+					}
+					for (byte k = 0; k < 5; k++) {
+						const size_t i = (c * 5) + k;
+						bit = (src[k] & 1) ^ !bit;
+						if (i == sz - 1) break;
+						Out[i] = table[k][bit][i & 1][in[k]];
+					}
+				}
+			}
+		}
 		/*******!
 		 * @brief
 		 * 			mixes the bits from the input vector based on 
@@ -313,74 +515,18 @@ namespace NACHA {
 		 * @returns
 		 * 			mixed-bit byte vector.
 		 ********/
-		inline std::vector<byte> mix(const std::vector<byte> &Input, bool form) {
+		size_t mix(const byte* Input, size_t Size, bool form, byte* Out, bool wide) {
 			//! This is necessary to move things around after permutation.
 			//! Operates on blocks of 5. padding is CABEDF
 			//! Form causes a cool inverse, but that's about it
-			uint sz = Input.size();
-			std::vector<byte> tmp = Input;
-			const byte Underflow = 5 - (sz % 5);
-			if (Underflow > 0) {
-				std::vector<byte> d = {0xCA,  0xBE, 0xDF};
-				byte cnt=0, app = 0;
-				while (cnt < Underflow) {
-					tmp.push_back(d[app]);
-					if (app == 2) app = 0; else app++;
-					cnt++;
-				}
-				sz = tmp.size();
-				cnt ^= cnt;
-				app ^= app;
-			}
-			std::vector<byte> outa;
-			for (uint c = 0; c < (sz / 5); c++) {
-				const byte IND = (c * 5) % 256;
-				std::vector<byte> chunk(5, 0);
-				byte bind = 0; bool pnt = 1;
-				byte last = tmp[sz - 1];
-				//This loop: bytes per chunk
-				for (byte i=0;i<5;i++) {
-					byte n = tmp[IND + i];
-					if (pnt) n ^= ~last;
-					//This loop: bits per byte
-					for (byte B = 0; B < 8; B++) {
-						bool bit = n & 1;
-						byte J = bit;
-						if (pnt) {
-							if (form) J = (~J << bind); else J <<= bind;
-						} else {
-							J <<= bind + 3; bind++;
-						}
-						pnt = !pnt;
-						chunk[i] ^= J;
-						
-						J ^= J;
-					}
-					last = n;
-					n ^= n;
-				}
-				bind ^= bind;
-				//This loop: move chunk to output, inverting every other byte
-				bool inv = 0;
-				for (byte& i : chunk) {
-					if (inv) outa.push_back(~i); else outa.push_back(i + form);
-					inv = !inv;
-					i ^= i;
-				}
-			}
-			tmp.clear();
-			std::vector<byte> outb;
-			bool toggle = 0;
-			for (uint i =0; i < sz - 1; i++) {
-				byte J = (tmp[i] ^ ~outa[i]) ^ ((outa[i] << 3) | (outa[i] >> 5));
-				if (toggle) {J ^= (((tmp[i] >> 2) * outa[i]) + ((tmp[i] + outa[i]) >> 3)) % 256;} //affine ciphering
-				if (form) {J ^= (~outa[i] >> 3) | (outa[i] << 5);}
-				toggle = !toggle;
-				outb.push_back(J);
-				J ^= J;
-			}
-			outa.clear();
-			return outb;
+			const size_t sz = mixSize(Size) + 1;
+			mixBlocks(Input, Size, form, Out, 0, sz / 5, wide);
+			return sz - 1;
+		}
+		std::vector<byte> mix(const std::vector<byte> &Input, bool form) {
+			std::vector<byte> out(mixSize(Input.size()));
+			mix(Input.data(), Input.size(), form, out.data());
+			return out;
 		}
 		/********!
 		 * @brief
@@ -400,32 +546,30 @@ namespace NACHA {
 		 * @exception std::invalid_argument
 		 * 			When either input is not \c _capac in length.
 		 ********/
-		inline std::vector<byte> intertwine(const std::vector<byte> &InA, const std::vector<byte> &InB, const ushort _capac) {
-			if (InA.size() != _capac) throw std::invalid_argument("Input A to intertwine is not the length of the specified capacity!");
-			if (InB.size() != _capac) throw std::invalid_argument("Input B to intertwine is not the length of the specified capacity!");
-			std::vector<byte> temp2;
+		void intertwine(const byte* InA, const byte* InB, const ushort _capac, byte* Out) {
+			const std::vector<ushort>& fold = capacityTables(_capac).fold;
 			for (ushort i = 0; i < _capac; i++) {
 				byte a = InA[i], b = InB[(_capac - 1) - i];
 				
-				ushort ind = i + (a ^ b); while (ind >= _capac) {ind -= _capac / 2;}
+				ushort ind = fold[i + (a ^ b)];
 				
 				byte c = InA[(_capac - 1) - ind], d = InB[ind];
 				
 				uint J = a * b; byte N = (J + (c ^ d)) % 256;
-				temp2.push_back(a ^ b ^ c ^ N ^ ~((N << 4) ^ d >> 4));
-				
-				a ^= a;
-				b ^= b;
-				c ^= c;
-				d ^= d;
-				N ^= N;
+				Out[i] = a ^ b ^ c ^ N ^ ~((N << 4) ^ d >> 4);
 			}
+		}
+		std::vector<byte> intertwine(const std::vector<byte> &InA, const std::vector<byte> &InB, const ushort _capac) {
+			if (InA.size() != _capac) throw std::invalid_argument("Input A to intertwine is not the length of the specified capacity!");
+			if (InB.size() != _capac) throw std::invalid_argument("Input B to intertwine is not the length of the specified capacity!");
+			std::vector<byte> temp2(_capac);
+			intertwine(InA.data(), InB.data(), _capac, temp2.data());
 			return temp2;
 		}
 	}
 	
 	//! Divides \c in into \c osize groups, padding with bytes from \c padding
-	inline std::vector<std::vector<byte>> split(const std::vector<byte>& in, byte osize, std::vector<byte> padding /*= {0x11,0x22,0x33,0x44,0x55,0x66,0x77}*/) {
+	std::vector<std::vector<byte>> split(const std::vector<byte>& in, byte osize, std::vector<byte> padding /*= {0x11,0x22,0x33,0x44,0x55,0x66,0x77}*/) {
 		std::vector<byte> tmp = in;
 		std::vector<std::vector<byte>> out;
 		uint tsize = tmp.size(); byte underflow = osize - (tsize % osize);
@@ -454,109 +598,776 @@ namespace NACHA {
 	}
 	
 	//! Fuses a vector of byte vectors into one vector
-	inline std::vector<byte> fuse(std::vector<std::vector<byte>> in) {
+	std::vector<byte> fuse(std::vector<std::vector<byte>> in) {
 		std::vector<byte> tmp;
 		for (std::vector<byte> i : in) {
 			for (byte N : i) tmp.push_back(N);
 		}
 		return tmp;
 	}
-
-
-	//! Hash \c in , with the output capacity \c _capac , using two divisors \c _blkA and \c _blkB
-	std::vector<byte> hash(const std::vector<byte>& in, const ushort _capac, const byte _blkA, const byte _blkB) {
-		//! Capacity - output size, in bytes
-		//! Block A  - first division size, as a denominator
-		//! Block B  - second division size, as a denominator
-		std::vector<std::vector<byte>> CHK = split(in, _blkB);
-		std::vector<std::vector<byte>> NCHK;
-		bool toggle = 0;
-		for (std::vector<byte> i : CHK) {
-			NCHK.push_back(low::permuteA(i));
-			if (toggle) {
-				NCHK.push_back(low::mix(i,1));
-				NCHK.push_back(low::permuteC(i));
-			}
-			toggle = !toggle;
+	
+	namespace {
+		const byte splitPad[7] = {0x11,0x22,0x33,0x44,0x55,0x66,0x77};
+		
+		//! Mirrors split(): the chunk length is stored as a ushort there, and any partial chunk is dropped.
+		//! NACHA-L keeps the full length, so it always makes exactly \c osize chunks.
+		SplitPlan planSplit(size_t n, byte osize, bool wide) {
+			SplitPlan S;
+			S.padded = n + (osize - (n % osize));
+			S.len = wide ? (S.padded / osize) : ushort(S.padded / osize);
+			S.count = S.len ? (S.padded / S.len) : 0;
+			return S;
 		}
-		// Reset
-		toggle = 1;
-		NCHK.push_back(low::mix(in,1)); //insert our input
-		CHK = split(fuse(NCHK), _blkA); NCHK.clear();
-		for (std::vector<byte> i : CHK) {
-			NCHK.push_back(low::permuteC(i));
-			if (toggle) {
-				NCHK.push_back(low::mix(i,0));
-				NCHK.push_back(low::permuteA(low::mix(i,1)));
-			}
-			toggle = !toggle;
+		//! Writes split()'s padding right after \c n bytes of \c buf
+		inline void padSplit(byte* buf, size_t n, byte osize) {
+			const byte underflow = osize - (n % osize);
+			for (byte i = 0; i < underflow; i++) buf[n + i] = splitPad[i % 7];
 		}
-		// Append Input
-		toggle = 0;
-		CHK = split(in, _blkB);
-		for (std::vector<byte> i : CHK) {
-			NCHK.push_back(low::mix(low::permuteC(i),0));
-			if (toggle) NCHK.push_back(low::permuteA(low::mix(i,1)));
-			toggle = !toggle;
+		inline size_t mixOfC(size_t n) {return low::mixSize(low::permuteCSize(n));}
+		inline size_t permuteAOfMix(size_t n) {return low::permuteASize(low::mixSize(n));}
+		
+		//! Where chunk \c j's output starts, when every chunk writes \c always bytes and every other one \c extra more
+		inline size_t chunkOffset(size_t j, size_t always, size_t extra, bool extrasOnOdd) {
+			return (j * always) + ((extrasOnOdd ? (j / 2) : ((j + 1) / 2)) * extra);
 		}
-		// Reset
-		toggle = 1;
-		CHK = split(fuse(NCHK), _blkA); NCHK.clear();
-		for (std::vector<byte> i : CHK) {
-			NCHK.push_back(low::mix(low::permuteB(i),1));
-			if (toggle) NCHK.push_back(low::permuteC(i));
-			toggle = !toggle;
+	}
+	
+	HashPlan::HashPlan(size_t _inSize, ushort _capac, byte _blkA, byte _blkB, uint _workers, bool _wide) : inSize(_inSize), capac(_capac), blkA(_blkA), blkB(_blkB), workers(_workers ? _workers : 1), wide(_wide) {
+		using namespace low;
+		if (_capac < 2) throw std::invalid_argument("Capacity provided to NACHA must be at least two bytes!");
+		if (_blkA == 0 || _blkB == 0) throw std::invalid_argument("Block sizes provided to NACHA must be nonzero!");
+		// Stage 1 (toggles from 0): A(x) always, then mix(x,1) and C(x) on every other chunk, then mix(in,1)
+		stage1 = planSplit(inSize, blkB, wide);
+		size_t L = stage1.len, odd = stage1.count / 2;
+		fused1 = (stage1.count * permuteASize(L)) + (odd * (mixSize(L) + permuteCSize(L))) + mixSize(inSize);
+		size_t need = permuteBSize(L);
+		// Stage 2 (toggles from 1): C(x) always, then mix(x,0) and A(mix(x,1))
+		stage2 = planSplit(fused1, blkA, wide);
+		L = stage2.len;
+		fused2 = (stage2.count * permuteCSize(L)) + (((stage2.count + 1) / 2) * (mixSize(L) + permuteAOfMix(L)));
+		need = std::max(need, std::max(permuteBSize(L), mixSize(L)));
+		// Stage 3 (toggles from 0, on the input again): mix(C(x),0) always, then A(mix(x,1))
+		L = stage1.len;
+		fused2 += (stage1.count * mixOfC(L)) + (odd * permuteAOfMix(L));
+		need = std::max(need, std::max(permuteCSize(L) + permuteBSize(L), mixSize(L)));
+		// Stage 4 (toggles from 1): mix(B(x),1) always, then C(x), then the input
+		stage4 = planSplit(fused2, blkA, wide);
+		L = stage4.len;
+		fused3 = (stage4.count * mixSize(permuteBSize(L))) + (((stage4.count + 1) / 2) * permuteCSize(L)) + inSize;
+		need = std::max(need, permuteBSize(L));
+		// Stage 5 (toggles from 0): mix(C(x),0) always, then A(x)
+		stage5 = planSplit(fused3, blkB, wide);
+		L = stage5.len;
+		fused4 = (stage5.count * mixOfC(L)) + ((stage5.count / 2) * permuteASize(L));
+		need = std::max(need, permuteCSize(L) + permuteBSize(L));
+		final = mixSize(fused4);
+		
+		// The compression ratio was a ushort; past that it can never produce _capac bytes
+		ratio = (final + (capac - (final % capac))) / capac;
+		if (!wide && ratio > 0xFFFF) throw std::invalid_argument("Input A to intertwine is not the length of the specified capacity!");
+		
+		// Stages 1, 3 and the final mix share region A; stages 2 and 4 share region B
+		regionA = std::max(std::max(fused1 + blkA, fused3 + blkB), final + capac);
+		regionB = std::max(fused2 + blkA, fused4);
+		scratch = need;
+		tail = stage1.len + blkB;
+		arenaSize = regionA + regionB + tail + capac + (workers * scratch);
+	}
+	
+	const std::vector<Variant>& variants() {
+		static const std::vector<Variant> table = {
+			{"128", 16, 5, 3}, {"128E", 16, 7, 4},
+			{"256", 32, 7, 4}, {"256E", 32, 9, 5},
+			{"384", 48, 9, 5}, {"384E", 48, 11, 6},
+			{"512", 64, 11, 6}, {"512E", 64, 13, 7},
+			{"768", 96, 13, 7}, {"768E", 96, 15, 8}
+		};
+		return table;
+	}
+	//! Looks a parameter set up by name, throwing std::invalid_argument for unknown ones
+	const Variant& findVariant(const std::string& name) {
+		for (const Variant& i : variants()) {
+			if (name == i.name) return i;
 		}
+		throw std::invalid_argument("Unknown NACHA variant '" + name + "'!");
+	}
+	
+	/********!
+	 * @brief
+	 * 			Runs the full hashing pipeline for \c plan inside one arena.
+	 * 
+	 * @param [in] plan
+	 * 			Sizes for this input length and parameter set.
+	 * @param [in] in
+	 * 			Message to hash, \c plan.inSize bytes long.
+	 * @param [inout] arena
+	 * 			Working memory, at least \c plan.arenaSize bytes.
+	 * @param [out] out
+	 * 			Digest, \c plan.capac bytes long.
+	 * 
+	 * @details
+	 * 			Every chunk the old \c split() handed out is now a slice of
+	 * 			a fused stage buffer, with split's padding written in place
+	 * 			after it. Only the trailing chunks of \c in are copied, into
+	 * 			the 'tail' area, since they run into the padding.
+	 * 
+	 * 			With <CODE>plan.workers > 1</CODE>, each stage's chunk loop
+	 * 			(and the two whole-buffer mixes) is divided between that many
+	 * 			threads. Output offsets come from the plan, so the digest is
+	 * 			identical to the serial run.
+	 ********/
+	void hash(const HashPlan& plan, const byte* in, byte* arena, byte* out) {
+		using namespace low;
+		byte* const RA = arena;
+		byte* const RB = RA + plan.regionA;
+		byte* const T = RB + plan.regionB;
+		byte* const K = T + plan.tail;
+		byte* const S = K + plan.capac; //one scratch area per worker
+		const size_t n = plan.inSize;
+		const uint workers = plan.workers;
+		const bool wide = plan.wide;
+		
+		// Chunks of split(in, _blkB) that run past the input come from the tail copy
+		const size_t L1 = plan.stage1.len;
+		const size_t tailStart = L1 ? (n / L1) * L1 : 0;
+		for (size_t i = tailStart; i < plan.stage1.padded; i++) T[i - tailStart] = (i < n) ? in[i] : splitPad[(i - n) % 7];
+		auto inChunk = [&](size_t j) -> const byte* {
+			const size_t at = j * L1;
+			return (at < tailStart) ? (in + at) : (T + (at - tailStart));
+		};
+		
+		size_t L = L1;
+		Threading::forRange(plan.stage1.count, workers, [&](size_t first, size_t last, uint t) {
+			const size_t always = permuteASize(L), extra = mixSize(L) + permuteCSize(L);
+			for (size_t j = first; j < last; j++) {
+				const byte* i = inChunk(j);
+				byte* w = RA + chunkOffset(j, always, extra, 1);
+				w += permuteA(i, L, w, wide);
+				if (j & 1) {
+					w += mix(i, L, 1, w, wide);
+					w += permuteC(i, L, w, S + (t * plan.scratch), wide);
+				}
+			}
+		});
+		byte* const mixed = RA + plan.fused1 - mixSize(n);
+		Threading::forRange((mixSize(n) + 1) / 5, workers, [&](size_t first, size_t last, uint) {
+			mixBlocks(in, n, 1, mixed, first, last, wide); //insert our input
+		});
+		padSplit(RA, plan.fused1, plan.blkA);
+		
+		// Reset
+		L = plan.stage2.len;
+		Threading::forRange(plan.stage2.count, workers, [&](size_t first, size_t last, uint t) {
+			byte* const S_t = S + (t * plan.scratch);
+			const size_t always = permuteCSize(L), extra = mixSize(L) + permuteAOfMix(L);
+			for (size_t j = first; j < last; j++) {
+				const byte* i = RA + (j * L);
+				byte* w = RB + chunkOffset(j, always, extra, 0);
+				w += permuteC(i, L, w, S_t, wide);
+				if (!(j & 1)) {
+					w += mix(i, L, 0, w, wide);
+					w += permuteA(S_t, mix(i, L, 1, S_t, wide), w, wide);
+				}
+			}
+		});
+		// Append Input
+		byte* const appended = RB + plan.fused2 - ((plan.stage1.count * mixOfC(L1)) + ((plan.stage1.count / 2) * permuteAOfMix(L1)));
+		Threading::forRange(plan.stage1.count, workers, [&](size_t first, size_t last, uint t) {
+			byte* const S_t = S + (t * plan.scratch);
+			for (size_t j = first; j < last; j++) {
+				const byte* i = inChunk(j);
+				byte* w = appended + chunkOffset(j, mixOfC(L1), permuteAOfMix(L1), 1);
+				w += mix(S_t, permuteC(i, L1, S_t, S_t + permuteCSize(L1), wide), 0, w, wide);
+				if (j & 1) w += permuteA(S_t, mix(i, L1, 1, S_t, wide), w, wide);
+			}
+		});
+		padSplit(RB, plan.fused2, plan.blkA);
+		
+		// Reset
+		L = plan.stage4.len;
+		Threading::forRange(plan.stage4.count, workers, [&](size_t first, size_t last, uint t) {
+			byte* const S_t = S + (t * plan.scratch);
+			const size_t always = mixSize(permuteBSize(L)), extra = permuteCSize(L);
+			for (size_t j = first; j < last; j++) {
+				const byte* i = RB + (j * L);
+				byte* w = RA + chunkOffset(j, always, extra, 0);
+				w += mix(S_t, permuteB(i, L, S_t, wide), 1, w, wide);
+				if (!(j & 1)) w += permuteC(i, L, w, S_t, wide);
+			}
+		});
 		// Insert Input
-		NCHK.push_back(in); 
+		std::memcpy(RA + plan.fused3 - n, in, n);
+		padSplit(RA, plan.fused3, plan.blkB);
+		
 		// Reset
-		toggle = 0;
-		CHK = split(fuse(NCHK), _blkB); NCHK.clear();
-		for (std::vector<byte> i : CHK) {
-			NCHK.push_back(low::mix(low::permuteC(i),0));
-			if (toggle) NCHK.push_back(low::permuteA(i));
-			toggle = !toggle;
-		}
-		std::vector<byte> temp = low::mix(fuse(NCHK),1); NCHK.clear(); CHK.clear();
+		L = plan.stage5.len;
+		Threading::forRange(plan.stage5.count, workers, [&](size_t first, size_t last, uint t) {
+			byte* const S_t = S + (t * plan.scratch);
+			const size_t always = mixOfC(L), extra = permuteASize(L);
+			for (size_t j = first; j < last; j++) {
+				const byte* i = RA + (j * L);
+				byte* w = RB + chunkOffset(j, always, extra, 1);
+				w += mix(S_t, permuteC(i, L, S_t, S_t + permuteCSize(L), wide), 0, w, wide);
+				if (j & 1) w += permuteA(i, L, w, wide);
+			}
+		});
+		byte* const temp = RA;
+		Threading::forRange((plan.final + 1) / 5, workers, [&](size_t first, size_t last, uint) {
+			mixBlocks(RB, plan.fused4, 1, temp, first, last, wide);
+		});
 		
 		// Compress using XOR
-		uint siz = temp.size(); ushort add = _capac - (siz % _capac);
-		toggle = 0;
-		while (add > 0) {
-			temp.push_back( 0x5A );
-			add--;
-		}
-		siz = temp.size();
-		const ushort ratio = (siz / _capac);
-		std::vector<byte> temp2; std::vector<byte> blk(ratio, 0);
-		ushort blkIn = 0; toggle = 0;
+		const ushort _capac = plan.capac;
+		const size_t siz = plan.ratio * _capac;
+		for (size_t i = plan.final; i < siz; i++) temp[i] = 0x5A;
+		byte* const temp2 = K;
 		byte lastxor = (~temp[siz - 1]) >> 3;
-		for (uint i = 0; i < siz; i++) {
-			if (toggle) blk[blkIn] = byte(temp[i] + lastxor); else blk[blkIn] = temp[i];
-			blkIn++; toggle = !toggle;
-			if (blkIn == ratio) {
-				//Condense
-				byte j = 0;
-				for (byte A : blk) {
-					j ^= A;
-				}
-				temp2.push_back(j);
-				lastxor = byte((~j) >> 3);
-				blkIn = 0;
+		if (wide) lastxor ^= byte('L' + lVersion); //keeps NACHA-L digests apart, even where no index is past 256
+		for (size_t b = 0; b < _capac; b++) {
+			//Condense
+			byte j = 0;
+			for (size_t i = b * plan.ratio; i < (b + 1) * plan.ratio; i++) {
+				if (i & 1) j ^= byte(temp[i] + lastxor); else j ^= temp[i];
 			}
+			temp2[b] = j;
+			lastxor = byte((~j) >> 3);
 		}
 		//Is now '_capac' long
-		temp.clear();
-		for (ushort i =0; i < _capac; i++) {
-			//Semi-Affine method
-			byte N = i % 256;
-			byte T = ((N + lastxor) * (N + (i ^ _capac))) % 256;
-			temp.push_back( T );
-		}
-		lastxor ^= lastxor;
-		blk.clear();
+		//Semi-Affine vector, cached for every trailing XOR value of this capacity
+		const byte* affine = capacityTables(_capac).affine.data() + (lastxor * size_t(_capac));
 		//intertwine with a vector of _capac length, but is just 0 - 255
-		return low::intertwine(temp2, temp, _capac);
+		intertwine(temp2, affine, _capac, out);
+	}
+	//! As above, in a reusable \c arena that is only grown when it is too small
+	void hash(const HashPlan& plan, const byte* in, std::vector<byte>& arena, byte* out) {
+		if (arena.size() < plan.arenaSize) arena.resize(plan.arenaSize);
+		hash(plan, in, arena.data(), out);
+	}
+	namespace {
+		//! Past this much arena, scattered input goes through hashStreamed() rather than being staged
+		const size_t gatherAbove = size_t(1) << 20;
+		
+		inline const byte* partData(const bytespan& p) noexcept {return p.data;}
+		inline size_t partSize(const bytespan& p) noexcept {return p.size;}
+		inline const byte* partData(const struct iovec& p) noexcept {return static_cast<const byte*>(p.iov_base);}
+		inline size_t partSize(const struct iovec& p) noexcept {return p.iov_len;}
+		
+		/********!
+		 * @brief
+		 * 			\c hash() over \c count buffers, read as if they were
+		 * 			one message of \c plan.inSize bytes.
+		 * 
+		 * @details
+		 * 			A single buffer is hashed in place. Several are gathered
+		 * 			into \c arena just past the pipeline's own space, so no
+		 * 			call allocates once the arena has grown. Past
+		 * 			\c gatherAbove, the buffers are read where they are by
+		 * 			\c hashStreamed(), which never holds the whole message.
+		 ********/
+		template<class Part> void hashParts(const HashPlan& plan, const Part* parts, size_t count, std::vector<byte>& arena, byte* out) {
+			size_t total = 0;
+			for (size_t i = 0; i < count; i++) total += partSize(parts[i]);
+			if (total != plan.inSize) throw std::invalid_argument("Scattered NACHA input does not add up to the planned length!");
+			
+			if (plan.arenaSize > gatherAbove) {
+				std::vector<uint64_t> starts(count + 1, 0);
+				for (size_t i = 0; i < count; i++) starts[i + 1] = starts[i] + partSize(parts[i]);
+				hashStreamed(plan, [&](uint64_t offset, size_t len, byte* dst) {
+					size_t i = size_t(std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin()) - 1;
+					for (; len > 0; i++) {
+						const size_t at = size_t(offset - starts[i]), take = std::min(len, partSize(parts[i]) - at);
+						std::memcpy(dst, partData(parts[i]) + at, take);
+						dst += take; offset += take; len -= take;
+					}
+				}, out);
+				return;
+			}
+			size_t nonEmpty = 0, only = 0;
+			for (size_t i = 0; i < count; i++) if (partSize(parts[i])) {nonEmpty++; only = i;}
+			if (nonEmpty == 1) {
+				hash(plan, partData(parts[only]), arena, out);
+				return;
+			}
+			if (arena.size() < plan.arenaSize + total) arena.resize(plan.arenaSize + total);
+			byte* const staged = arena.data() + plan.arenaSize;
+			for (size_t i = 0, at = 0; i < count; at += partSize(parts[i]), i++) if (partSize(parts[i])) std::memcpy(staged + at, partData(parts[i]), partSize(parts[i]));
+			hash(plan, staged, arena.data(), out);
+			std::fill(staged, staged + total, 0); //basic memory sanitation
+		}
+	}
+	//! \c hash() of the concatenation of \c parts, without the caller joining them first
+	void hash(const HashPlan& plan, const bytespan* parts, size_t count, std::vector<byte>& arena, byte* out) {
+		hashParts(plan, parts, count, arena, out);
+	}
+	void hash(const HashPlan& plan, const struct iovec* parts, size_t count, std::vector<byte>& arena, byte* out) {
+		hashParts(plan, parts, count, arena, out);
+	}
+
+	//! Hash \c in , with the output capacity \c _capac , using two divisors \c _blkA and \c _blkB
+	std::vector<byte> hash(const std::vector<byte>& in, const ushort _capac, const byte _blkA, const byte _blkB) {
+		//! Capacity - output size, in bytes
+		//! Block A  - first division size, as a denominator
+		//! Block B  - second division size, as a denominator
+		return hash(in, _capac, _blkA, _blkB, 1);
+	}
+	//! As above, spreading each stage across \c workers threads; the digest does not change
+	std::vector<byte> hash(const std::vector<byte>& in, const ushort _capac, const byte _blkA, const byte _blkB, const uint workers) {
+		const HashPlan plan(in.size(), _capac, _blkA, _blkB, workers);
+		std::vector<byte> arena(plan.arenaSize), out(_capac);
+		hash(plan, in.data(), arena, out.data());
+		std::fill(arena.begin(), arena.end(), 0); //basic memory sanitation
+		return out;
+	}
+	/********!
+	 * @brief
+	 * 			Hashes \c count messages with one set of parameters, writing
+	 * 			digest \c i to <CODE>out + (i * _capac)</CODE>.
+	 * 
+	 * @details
+	 * 			Messages are grouped by length, since every intermediate size
+	 * 			in \c hash() is a function of the length alone. Each group
+	 * 			builds its plan once, and the whole batch shares one arena,
+	 * 			sized for the longest message; a batch of short records
+	 * 			therefore costs a single allocation rather than one per call.
+	 * 
+	 * @note
+	 * 			Digests match \c hash() on each message individually.
+	 ********/
+	void hashBatch(const bytespan* msgs, size_t count, byte* out, const ushort _capac, const byte _blkA, const byte _blkB) {
+		std::vector<size_t> order(count);
+		for (size_t i = 0; i < count; i++) order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [msgs](size_t a, size_t b) {return msgs[a].size < msgs[b].size;});
+		
+		std::vector<byte> arena;
+		if (count) arena.reserve(HashPlan(msgs[order.back()].size, _capac, _blkA, _blkB).arenaSize);
+		size_t at = 0;
+		while (at < count) {
+			const HashPlan plan(msgs[order[at]].size, _capac, _blkA, _blkB);
+			for (; at < count && msgs[order[at]].size == plan.inSize; at++) {
+				hash(plan, msgs[order[at]].data, arena, out + (order[at] * _capac));
+			}
+		}
+		std::fill(arena.begin(), arena.end(), 0); //basic memory sanitation
+	}
+	
+	/********!
+	 * @brief
+	 * 			NACHA-L: the \c hash() pipeline with 64-bit indexing all the
+	 * 			way through, for inputs of any size.
+	 * 
+	 * @details
+	 * 			NACHA's kernels index with bytes and its splits with ushorts,
+	 * 			so permuteA/B only ever read the first 256 bytes of a chunk,
+	 * 			mix() takes its chains from <CODE>(c * 5) % 256</CODE>, and
+	 * 			large inputs lose chunks or throw. NACHA-L reads every chunk
+	 * 			and block in place, always splits into exactly \c _blkA or
+	 * 			\c _blkB chunks, and has no compression limit, so every byte
+	 * 			of the input reaches every stage.
+	 * 
+	 * 			Its digests are a different function from \c hash(), tagged
+	 * 			by \c lVersion: the compression's running XOR starts from it,
+	 * 			so short inputs, which index the same either way, still give
+	 * 			different digests.
+	 * 
+	 * @note
+	 * 			With nothing cut short, the arena is about 45 times the input;
+	 * 			\c workers splits each stage between that many threads.
+	 ********/
+	void hashL(const byte* in, size_t size, byte* out, const ushort _capac, const byte _blkA, const byte _blkB, const uint workers) {
+		const HashPlan plan(size, _capac, _blkA, _blkB, workers, true);
+		std::vector<byte> arena(plan.arenaSize);
+		hash(plan, in, arena, out);
+		std::fill(arena.begin(), arena.end(), 0); //basic memory sanitation
+	}
+	std::vector<byte> hashL(const std::vector<byte>& in, const ushort _capac, const byte _blkA, const byte _blkB, const uint workers) {
+		std::vector<byte> out(_capac);
+		hashL(in.data(), in.size(), out.data(), _capac, _blkA, _blkB, workers);
+		return out;
+	}
+	
+	namespace {
+		//! The most any kernel reads from the front of its input: 256 bytes for permuteA/B/C, 260 for mix's chains
+		const size_t prefixSize = 260;
+		const size_t window = 4096;
+		
+		/********!
+		 * @brief
+		 * 			mix() one output byte at a time, from the first 260 bytes
+		 * 			of its input plus the input byte at that position.
+		 * 
+		 * @details
+		 * 			A block's chained low bits only depend on where it reads
+		 * 			its 'src' bytes from, <CODE>(c * 5) % 256</CODE>, so all
+		 * 			256 chains are worked out once up front.
+		 ********/
+		struct MixGen {
+			const byte (*table)[2][2][256];
+			byte chain[256]; //bit k: the chained bit for byte k of a block whose 'src' starts here
+			size_t M;
+			
+			//! \c Y holds the input's first 260 bytes, running into mix's padding past \c _M
+			void init(const byte* Y, size_t _M, bool form) {
+				this->M = _M;
+				this->table = low::mixTables.pass[form];
+				const byte lastInit = low::padM[(low::mixSize(_M) - _M) % 3]; //mix() reads one past its output, always in the padding
+				for (uint IND = 0; IND < 256; IND++) {
+					bool bit = lastInit & 1; byte c = 0;
+					for (byte k = 0; k < 5; k++) {
+						bit = (Y[IND + k] & 1) ^ !bit;
+						c |= byte(bit) << k;
+					}
+					this->chain[IND] = c;
+				}
+			}
+			byte pad(size_t i) const {return low::padM[(i - this->M) % 3];}
+			//! Output byte \c i, given input byte \c yi (or \c pad(i) past the input)
+			byte at(size_t i, byte yi) const {
+				const size_t c = i / 5; const byte k = i % 5;
+				return this->table[k][(this->chain[(c * 5) % 256] >> k) & 1][i & 1][yi];
+			}
+		};
+		
+		//! permuteA, B and C one output byte at a time, from the first 256 bytes of their input
+		struct PermGen {
+			byte P[256];
+			size_t nsize;
+			byte tot;
+			
+			void init(const byte* raw, size_t L, bool isB) {
+				using namespace low;
+				this->nsize = permuteBSize(L);
+				const size_t chunks = this->nsize / 8, distinct = std::min(chunks, permuteSpan), direct = std::min(distinct, L / 8);
+				const byte* pad = isB ? padB : padA;
+				transposeChunks(raw, direct, this->P);
+				if (direct < distinct) {
+					byte src[8];
+					loadChunk(raw, L, direct * 8, 8, pad, 4, src);
+					transposeChunks(src, 1, this->P + (direct * 8));
+				}
+				this->tot = 0;
+				if (isB) {
+					for (size_t k = 0; k < distinct * 8; k++) {
+						const byte B = k % 8, n = this->P[k];
+						if (B) this->P[k] = (n >> B) | (n << (8 - B));
+					}
+					return;
+				}
+				for (size_t c = 0; c < distinct; c++) {
+					if (!(((chunks - c + permuteSpan - 1) / permuteSpan) & 1)) continue;
+					byte src[8];
+					loadChunk(raw, L, c * 8, 8, padA, 4, src);
+					for (byte i = 0; i < 8; i++) this->tot ^= src[i];
+				}
+			}
+			byte a(size_t k) const {
+				if (k < this->nsize) return this->P[k % 256];
+				const size_t i = k - this->nsize;
+				const byte n = this->P[(this->nsize - 1 - i) % 256], j = this->P[i % 256];
+				return ((n >> 4) | (j << 4)) ^ (~(j & n) ^ this->tot);
+			}
+			byte b(size_t k) const {return this->P[k % 256];}
+			byte c(size_t i) const {
+				const byte t = this->P[i % 256], j = this->P[((this->nsize / 2) - i) % 256];
+				const byte o = (i & 1) ? byte((t >> 4) ^ (j << 4) ^ (t & ~j)) : byte((t >> 3) ^ (j << 5) ^ (~t & j));
+				return low::shrinkTable.out[i & 1][o];
+			}
+		};
+		
+		//! Where each chunk of one stage lands in its output, as laid out by chunkOffset()
+		struct ChunkLayout {
+			size_t len, count, always, extra;
+			bool extrasOnOdd;
+			
+			size_t end() const {return chunkOffset(this->count, this->always, this->extra, this->extrasOnOdd);}
+			size_t sizeOf(size_t j) const {return this->always + (((j & 1) == size_t(this->extrasOnOdd)) ? this->extra : 0);}
+			//! Chunk holding output byte \c p, leaving \c p relative to that chunk's output
+			size_t find(size_t& p) const {
+				const size_t pair = (2 * this->always) + this->extra, q = p / pair;
+				p -= q * pair;
+				const size_t first = this->sizeOf(0);
+				if (p < first) return 2 * q;
+				p -= first;
+				return (2 * q) + 1;
+			}
+		};
+		
+		/********!
+		 * @brief
+		 * 			hash()'s pipeline, with every stage's output computed on
+		 * 			demand at any offset instead of held in the arena.
+		 * 
+		 * @details
+		 * 			Each stage only needs a chunk's first 260 bytes to build its
+		 * 			permutations, and mix() is byte-for-byte given those, so a
+		 * 			stage can be read anywhere by reading the stage below at
+		 * 			that chunk's front (and, inside a mix, at the same offset).
+		 * 			The compression at the end only walks the last stage once.
+		 * 			Each stage keeps the context of the last chunk it touched,
+		 * 			which is all the memory this takes.
+		 ********/
+		class StreamedHash {
+			const HashPlan& plan;
+			const Reader& source;
+			ChunkLayout L1, L2, L3, L4, L5;
+			MixGen inMix; //mix(in, 1), at the end of stage 1
+			
+			struct Ctx1 {size_t j = SIZE_MAX; PermGen A, B; MixGen m1;} c1;
+			struct Ctx2 {size_t j = SIZE_MAX; PermGen B, AM; MixGen m0;} c2;
+			struct Ctx3 {size_t j = SIZE_MAX; PermGen B, AM; MixGen m0C;} c3;
+			struct Ctx4 {size_t j = SIZE_MAX; PermGen B; MixGen m1B;} c4;
+			struct Ctx5 {size_t j = SIZE_MAX; PermGen A, B; MixGen m0C;} c5;
+			
+			typedef void (StreamedHash::*Stage)(size_t, size_t, byte*);
+			
+			//! The first bytes of a chunk \c L long at \c base, as \c raw for PermGen and as \c Y for MixGen
+			void prefix(Stage lower, size_t base, size_t L, byte* raw) {
+				const size_t have = std::min(L, prefixSize);
+				(this->*lower)(base, have, raw);
+				for (size_t t = have; t < prefixSize; t++) raw[t] = low::padM[(t - L) % 3];
+			}
+			//! Prefix of mix(x, form), for permuteA(mix(x, 1))
+			void mixPrefix(const byte* Y, size_t L, const MixGen& g, byte* z) {
+				const size_t Mz = std::min(low::mixSize(L), size_t(256));
+				for (size_t t = 0; t < Mz; t++) z[t] = g.at(t, Y[t]);
+			}
+			//! mix() over bytes [p, p + m) of a chunk \c L long at \c base in stage \c lower
+			void mixChunk(const MixGen& g, Stage lower, size_t base, size_t L, size_t p, size_t m, byte* dst) {
+				byte buf[window];
+				while (m > 0) {
+					const size_t take = std::min(m, window), real = (p < L) ? std::min(take, L - p) : 0;
+					if (real) (this->*lower)(base + p, real, buf);
+					for (size_t i = 0; i < take; i++) dst[i] = g.at(p + i, (i < real) ? buf[i] : g.pad(p + i));
+					p += take; dst += take; m -= take;
+				}
+			}
+			//! mix() over bytes [p, p + m) of a permuted chunk \c M long, made by \c y
+			template<class Y> static void mixMade(const MixGen& g, size_t M, size_t p, size_t m, byte* dst, Y&& y) {
+				for (size_t i = 0; i < m; i++, p++) dst[i] = g.at(p, (p < M) ? y(p) : g.pad(p));
+			}
+			
+			//! Runs \c emit(j, p, take, dst) over the chunks of \c L that [pos, pos + len) touches
+			template<class F> static void forChunks(const ChunkLayout& L, size_t& pos, size_t& len, byte*& dst, F&& emit) {
+				const size_t end = L.end();
+				while (len > 0 && pos < end) {
+					size_t p = pos;
+					const size_t j = L.find(p);
+					const size_t take = std::min(len, L.sizeOf(j) - p);
+					emit(j, p, take, dst);
+					pos += take; len -= take; dst += take;
+				}
+			}
+			
+			void input(size_t pos, size_t len, byte* dst) {
+				const size_t n = this->plan.inSize;
+				if (pos < n) {
+					const size_t real = std::min(len, n - pos);
+					this->source(pos, real, dst);
+					pos += real; len -= real; dst += real;
+				}
+				for (size_t i = 0; i < len; i++) dst[i] = splitPad[(pos + i - n) % 7];
+			}
+			
+			// Stage 1, over split(in, _blkB): A(x), then mix(x,1) and C(x) on odd chunks; then mix(in,1)
+			void stage1(size_t pos, size_t len, byte* dst) {
+				const size_t L = this->L1.len;
+				forChunks(this->L1, pos, len, dst, [&](size_t j, size_t p, size_t m, byte* d) {
+					Ctx1& c = this->c1;
+					if (c.j != j) {
+						byte raw[prefixSize];
+						this->prefix(&StreamedHash::input, j * L, L, raw);
+						c.A.init(raw, L, 0); c.B.init(raw, L, 1); c.m1.init(raw, L, 1);
+						c.j = j;
+					}
+					const size_t A = low::permuteASize(L), X = low::mixSize(L);
+					for (; m > 0 && p < A; m--, p++) *d++ = c.A.a(p);
+					if (m > 0 && p < A + X) {
+						const size_t take = std::min(m, A + X - p);
+						this->mixChunk(c.m1, &StreamedHash::input, j * L, L, p - A, take, d);
+						d += take; p += take; m -= take;
+					}
+					for (; m > 0; m--, p++) *d++ = c.B.c(p - A - X);
+				});
+				const size_t end = this->L1.end(), mixed = low::mixSize(this->plan.inSize);
+				if (len > 0 && pos < end + mixed) {
+					const size_t take = std::min(len, end + mixed - pos);
+					this->mixChunk(this->inMix, &StreamedHash::input, 0, this->plan.inSize, pos - end, take, dst);
+					pos += take; len -= take; dst += take;
+				}
+				for (size_t i = 0; i < len; i++) dst[i] = splitPad[(pos + i - this->plan.fused1) % 7];
+			}
+			
+			// Stage 2, over split(stage 1, _blkA): C(x), then mix(x,0) and A(mix(x,1)) on even chunks;
+			// then stage 3, over split(in, _blkB) again: mix(C(x),0), then A(mix(x,1)) on odd chunks
+			void stage2(size_t pos, size_t len, byte* dst) {
+				forChunks(this->L2, pos, len, dst, [&](size_t j, size_t p, size_t m, byte* d) {
+					const size_t L = this->L2.len;
+					Ctx2& c = this->c2;
+					if (c.j != j) {
+						byte raw[prefixSize], z[256];
+						this->prefix(&StreamedHash::stage1, j * L, L, raw);
+						c.B.init(raw, L, 1); c.m0.init(raw, L, 0);
+						MixGen m1; m1.init(raw, L, 1);
+						this->mixPrefix(raw, L, m1, z);
+						c.AM.init(z, low::mixSize(L), 0);
+						c.j = j;
+					}
+					const size_t C = low::permuteCSize(L), X = low::mixSize(L);
+					for (; m > 0 && p < C; m--, p++) *d++ = c.B.c(p);
+					if (m > 0 && p < C + X) {
+						const size_t take = std::min(m, C + X - p);
+						this->mixChunk(c.m0, &StreamedHash::stage1, j * L, L, p - C, take, d);
+						d += take; p += take; m -= take;
+					}
+					for (; m > 0; m--, p++) *d++ = c.AM.a(p - C - X);
+				});
+				const size_t base = this->L2.end();
+				if (len > 0 && pos < this->plan.fused2) {
+					pos -= base;
+					forChunks(this->L3, pos, len, dst, [&](size_t j, size_t p, size_t m, byte* d) {
+						const size_t L = this->L3.len;
+						Ctx3& c = this->c3;
+						if (c.j != j) {
+							byte raw[prefixSize], Y[prefixSize], z[256];
+							this->prefix(&StreamedHash::input, j * L, L, raw);
+							c.B.init(raw, L, 1);
+							const size_t half = low::permuteCSize(L);
+							for (size_t t = 0; t < prefixSize; t++) Y[t] = (t < half) ? c.B.c(t) : low::padM[(t - half) % 3];
+							c.m0C.init(Y, half, 0);
+							MixGen m1; m1.init(raw, L, 1);
+							this->mixPrefix(raw, L, m1, z);
+							c.AM.init(z, low::mixSize(L), 0);
+							c.j = j;
+						}
+						const size_t half = low::permuteCSize(L), XC = mixOfC(L);
+						const size_t first = std::min(m, (p < XC) ? (XC - p) : 0);
+						mixMade(c.m0C, half, p, first, d, [&c](size_t i) {return c.B.c(i);});
+						for (size_t i = first; i < m; i++) d[i] = c.AM.a(p + i - XC);
+					});
+					pos += base;
+				}
+				for (size_t i = 0; i < len; i++) dst[i] = splitPad[(pos + i - this->plan.fused2) % 7];
+			}
+			
+			// Stage 4, over split(stages 2 and 3, _blkA): mix(B(x),1), then C(x) on even chunks; then the input
+			void stage4(size_t pos, size_t len, byte* dst) {
+				forChunks(this->L4, pos, len, dst, [&](size_t j, size_t p, size_t m, byte* d) {
+					const size_t L = this->L4.len;
+					Ctx4& c = this->c4;
+					if (c.j != j) {
+						byte raw[prefixSize], Y[prefixSize];
+						this->prefix(&StreamedHash::stage2, j * L, L, raw);
+						c.B.init(raw, L, 1);
+						const size_t nsize = low::permuteBSize(L);
+						for (size_t t = 0; t < prefixSize; t++) Y[t] = (t < nsize) ? c.B.b(t) : low::padM[(t - nsize) % 3];
+						c.m1B.init(Y, nsize, 1);
+						c.j = j;
+					}
+					const size_t nsize = low::permuteBSize(L), XB = low::mixSize(nsize);
+					const size_t first = std::min(m, (p < XB) ? (XB - p) : 0);
+					mixMade(c.m1B, nsize, p, first, d, [&c](size_t i) {return c.B.b(i);});
+					for (size_t i = first; i < m; i++) d[i] = c.B.c(p + i - XB);
+				});
+				const size_t base = this->L4.end(), n = this->plan.inSize;
+				if (len > 0 && pos < base + n) {
+					const size_t take = std::min(len, base + n - pos);
+					this->source(pos - base, take, dst);
+					pos += take; len -= take; dst += take;
+				}
+				for (size_t i = 0; i < len; i++) dst[i] = splitPad[(pos + i - this->plan.fused3) % 7];
+			}
+			
+			// Stage 5, over split(stage 4, _blkB): mix(C(x),0), then A(x) on odd chunks
+			void stage5(size_t pos, size_t len, byte* dst) {
+				forChunks(this->L5, pos, len, dst, [&](size_t j, size_t p, size_t m, byte* d) {
+					const size_t L = this->L5.len;
+					Ctx5& c = this->c5;
+					if (c.j != j) {
+						byte raw[prefixSize], Y[prefixSize];
+						this->prefix(&StreamedHash::stage4, j * L, L, raw);
+						c.A.init(raw, L, 0); c.B.init(raw, L, 1);
+						const size_t half = low::permuteCSize(L);
+						for (size_t t = 0; t < prefixSize; t++) Y[t] = (t < half) ? c.B.c(t) : low::padM[(t - half) % 3];
+						c.m0C.init(Y, half, 0);
+						c.j = j;
+					}
+					const size_t half = low::permuteCSize(L), XC = mixOfC(L);
+					const size_t first = std::min(m, (p < XC) ? (XC - p) : 0);
+					mixMade(c.m0C, half, p, first, d, [&c](size_t i) {return c.B.c(i);});
+					for (size_t i = first; i < m; i++) d[i] = c.A.a(p + i - XC);
+				});
+			}
+		public:
+			StreamedHash(const HashPlan& _plan, const Reader& _source) : plan(_plan), source(_source) {
+				using namespace low;
+				const size_t a = _plan.stage1.len, b = _plan.stage2.len, d = _plan.stage4.len, e = _plan.stage5.len;
+				this->L1 = {a, _plan.stage1.count, permuteASize(a), mixSize(a) + permuteCSize(a), 1};
+				this->L2 = {b, _plan.stage2.count, permuteCSize(b), mixSize(b) + permuteAOfMix(b), 0};
+				this->L3 = {a, _plan.stage1.count, mixOfC(a), permuteAOfMix(a), 1};
+				this->L4 = {d, _plan.stage4.count, mixSize(permuteBSize(d)), permuteCSize(d), 0};
+				this->L5 = {e, _plan.stage5.count, mixOfC(e), permuteASize(e), 1};
+				byte raw[prefixSize];
+				this->prefix(&StreamedHash::input, 0, _plan.inSize, raw);
+				this->inMix.init(raw, _plan.inSize, 1);
+			}
+			
+			//! mix(stage 5, 1), squeezed down to _capac bytes and intertwined as at the end of hash()
+			void digest(byte* out) {
+				const size_t M = this->plan.fused4, ratio = this->plan.ratio;
+				const ushort _capac = this->plan.capac;
+				byte raw[prefixSize];
+				this->prefix(&StreamedHash::stage5, 0, M, raw);
+				MixGen g; g.init(raw, M, 1);
+				
+				std::vector<byte> temp2(_capac);
+				const byte filler = 0x5A; //every compression pads at least one byte
+				byte lastxor = (~filler) >> 3, j = 0;
+				byte buf[window], temp[window];
+				const size_t siz = ratio * _capac;
+				for (size_t at = 0; at < siz; at += window) {
+					const size_t take = std::min(window, siz - at);
+					const size_t real = (at < M) ? std::min(take, M - at) : 0;
+					if (real) this->stage5(at, real, buf);
+					for (size_t i = 0; i < take; i++) {
+						const size_t k = at + i;
+						temp[i] = (k < this->plan.final) ? g.at(k, (i < real) ? buf[i] : g.pad(k)) : filler;
+					}
+					for (size_t i = 0; i < take; i++) {
+						const size_t k = at + i;
+						if (k & 1) j ^= byte(temp[i] + lastxor); else j ^= temp[i];
+						if ((k + 1) % ratio == 0) {
+							temp2[k / ratio] = j;
+							lastxor = byte((~j) >> 3);
+							j = 0;
+						}
+					}
+				}
+				const byte* affine = low::capacityTables(_capac).affine.data() + (lastxor * size_t(_capac));
+				low::intertwine(temp2.data(), affine, _capac, out);
+				std::fill(temp2.begin(), temp2.end(), 0); //basic memory sanitation
+			}
+		};
+	}
+	/********!
+	 * @brief
+	 * 			Same digest as \c hash(), for a message read through \c read
+	 * 			rather than held in memory, in a fixed amount of memory.
+	 * 
+	 * @details
+	 * 			Nothing here grows with \c plan.inSize: each stage keeps one
+	 * 			chunk's context (about 2KB) and a 4KB window on the stack.
+	 * 			\c read is called many times, mostly for short runs near the
+	 * 			front of each chunk, and must give the same bytes every time.
+	 * 
+	 * @note
+	 * 			Ignores \c plan.workers, and \c plan.arenaSize is not used.
+	 * 
+	 * @exception std::invalid_argument
+	 * 			For NACHA-L plans, whose kernels read every byte of their
+	 * 			input rather than the first 260.
+	 ********/
+	void hashStreamed(const HashPlan& plan, const Reader& read, byte* out) {
+		if (plan.wide) throw std::invalid_argument("NACHA-L plans cannot be hashed in streamed form!");
+		StreamedHash(plan, read).digest(out);
 	}
 }
 }
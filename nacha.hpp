@@ -4,23 +4,148 @@
 #include <vector>
 #include <stdexcept>
 #include <string>
+#include <cstddef>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <sys/uio.h>
 
 typedef unsigned char byte;
 typedef unsigned short ushort;
 typedef unsigned int uint;
 
 namespace ERCLIB {
+	//! Non-owning (pointer, length) view of some bytes; stands in for std::span on C++17
+	struct bytespan {
+		const byte* data;
+		size_t size;
+	};
 namespace NACHA {
 	namespace low {
-		extern inline std::vector<byte> permuteA(const std::vector<byte> &Input);
-		extern inline std::vector<byte> permuteB(const std::vector<byte> &Input);
-		extern inline std::vector<byte> permuteC(const std::vector<byte> &Input);
-		extern inline std::vector<byte> mix(const std::vector<byte> &Input, bool form);
+		//! Output sizes of the permutation functions for an input of \c n bytes
+		constexpr size_t permuteASize(size_t n) noexcept {return (((n / 8) + 1) * 16) - 1;}
+		constexpr size_t permuteBSize(size_t n) noexcept {return ((n / 8) + 1) * 8;}
+		constexpr size_t permuteCSize(size_t n) noexcept {return ((n / 8) + 1) * 4;}
+		constexpr size_t mixSize(size_t n) noexcept {return (((n / 5) + 1) * 5) - 1;}
+
+		//! Span-style kernels; these write into \c Out and return the number of bytes written.
+		//! \c wide selects NACHA-L's indexing, where chunks and mix blocks are read in place instead of modulo 256.
+		extern size_t permuteA(const byte* Input, size_t Size, byte* Out, bool wide = false);
+		extern size_t permuteB(const byte* Input, size_t Size, byte* Out, bool wide = false);
+		extern size_t permuteC(const byte* Input, size_t Size, byte* Out, byte* Scratch, bool wide = false);
+		extern size_t mix(const byte* Input, size_t Size, bool form, byte* Out, bool wide = false);
+		extern void intertwine(const byte* InA, const byte* InB, const ushort _capac, byte* Out);
+
+		extern std::vector<byte> permuteA(const std::vector<byte> &Input);
+		extern std::vector<byte> permuteB(const std::vector<byte> &Input);
+		extern std::vector<byte> permuteC(const std::vector<byte> &Input);
+		extern std::vector<byte> mix(const std::vector<byte> &Input, bool form);
 		extern std::vector<byte> intertwine(const std::vector<byte> &InA, const std::vector<byte> &InB, const ushort _capac);
 	}
-	extern inline std::vector<std::vector<byte>> split(const std::vector<byte>& in, byte osize, std::vector<byte> padding = {0x11,0x22,0x33,0x44,0x55,0x66,0x77});
-	extern inline std::vector<byte> fuse(std::vector<std::vector<byte>> in);
+	extern std::vector<std::vector<byte>> split(const std::vector<byte>& in, byte osize, std::vector<byte> padding = {0x11,0x22,0x33,0x44,0x55,0x66,0x77});
+	extern std::vector<byte> fuse(std::vector<std::vector<byte>> in);
+
+	//! Geometry of one \c split() call: \c count chunks of \c len bytes, taken from \c padded bytes
+	struct SplitPlan {
+		size_t len, count, padded;
+	};
+
+	//! Every intermediate size of \c hash() for one input length and parameter set.
+	//! The arena is laid out as [regionA][regionB][tail][compression][scratch, once per worker].
+	struct HashPlan {
+		size_t inSize;
+		ushort capac;
+		byte blkA, blkB;
+		uint workers; //threads each stage is divided across; 1 runs serially
+		bool wide; //NACHA-L rather than NACHA; see hashL()
+		SplitPlan stage1, stage2, stage4, stage5; //stage 3 re-splits the input, like stage 1
+		size_t fused1, fused2, fused3, fused4, final, ratio;
+		size_t regionA, regionB, scratch, tail, arenaSize;
+
+		explicit HashPlan(size_t _inSize, ushort _capac, byte _blkA, byte _blkB, uint _workers = 1, bool _wide = false);
+	};
+
+	//! A named parameter set; one per hashData function in liberc-crypto.hpp ("128" through "768E")
+	struct Variant {
+		const char* name;
+		ushort capac;
+		byte blkA, blkB;
+	};
+	extern const std::vector<Variant>& variants();
+	extern const Variant& findVariant(const std::string& name);
+
+	//! Copies \c len bytes at \c offset of a message into \c dst, for messages that are not held in memory
+	typedef std::function<void(uint64_t offset, size_t len, byte* dst)> Reader;
+	
+	extern void hash(const HashPlan& plan, const byte* in, byte* arena, byte* out);
+	extern void hash(const HashPlan& plan, const byte* in, std::vector<byte>& arena, byte* out);
+	//! Scatter-gather input: the digest of the parts joined end to end, which must total \c plan.inSize bytes
+	extern void hash(const HashPlan& plan, const bytespan* parts, size_t count, std::vector<byte>& arena, byte* out);
+	extern void hash(const HashPlan& plan, const struct iovec* parts, size_t count, std::vector<byte>& arena, byte* out);
+	extern void hashStreamed(const HashPlan& plan, const Reader& read, byte* out);
 	extern std::vector<byte> hash(const std::vector<byte>& in, const ushort _capac, const byte _blkA, const byte _blkB);
+	extern std::vector<byte> hash(const std::vector<byte>& in, const ushort _capac, const byte _blkA, const byte _blkB, const uint workers);
+	extern void hashBatch(const bytespan* msgs, size_t count, byte* out, const ushort _capac, const byte _blkA, const byte _blkB);
+	
+	//! Version of the NACHA-L construction behind \c hashL(); any change to its digests gets a new number
+	constexpr uint lVersion = 1;
+	extern void hashL(const byte* in, size_t size, byte* out, const ushort _capac, const byte _blkA, const byte _blkB, const uint workers = 1);
+	extern std::vector<byte> hashL(const std::vector<byte>& in, const ushort _capac, const byte _blkA, const byte _blkB, const uint workers = 1);
+
+	/********!
+	 * @brief
+	 * 			NACHA with its parameters fixed at compile time, returning
+	 * 			the digest by value as a <CODE>std::array<byte, Capac></CODE>.
+	 * 
+	 * @details
+	 * 			Bad parameters fail to compile instead of throwing, and there
+	 * 			is no heap digest. Each thread keeps one arena, so repeated
+	 * 			calls do not allocate either. It is wiped after every call,
+	 * 			and released once it grows past \c keptArena bytes.
+	 * 
+	 * @note
+	 * 			Templates stay in the header, like the ones in customizable.hpp.
+	 ********/
+	template<ushort Capac, byte BlkA, byte BlkB> struct Hasher {
+		static_assert(Capac >= 2, "NACHA capacity must be at least two bytes");
+		static_assert(BlkA != 0 && BlkB != 0, "NACHA block sizes must be nonzero");
+		
+		typedef std::array<byte, Capac> digest_type;
+		static constexpr ushort capacity = Capac;
+		static constexpr size_t keptArena = size_t(1) << 20;
+		
+		static digest_type digest(const byte* in, size_t size) {
+			thread_local std::vector<byte> arena;
+			const HashPlan plan(size, Capac, BlkA, BlkB);
+			digest_type out;
+			hash(plan, in, arena, out.data());
+			std::fill(arena.begin(), arena.begin() + plan.arenaSize, 0); //basic memory sanitation
+			if (arena.size() > keptArena) {arena.clear(); arena.shrink_to_fit();}
+			return out;
+		}
+		static digest_type digest(const std::vector<byte>& in) {return digest(in.data(), in.size());}
+		static digest_type digest(std::string_view in) {return digest(reinterpret_cast<const byte*>(in.data()), in.size());}
+		static digest_type digest(bytespan in) {return digest(in.data, in.size);}
+		//! The digest of \c count buffers joined end to end, read where they are
+		static digest_type digest(const bytespan* parts, size_t count) {return gathered(parts, count);}
+		static digest_type digest(const struct iovec* parts, size_t count) {return gathered(parts, count);}
+	private:
+		template<class Part> static digest_type gathered(const Part* parts, size_t count) {
+			thread_local std::vector<byte> arena;
+			size_t total = 0;
+			for (size_t i = 0; i < count; i++) total += partLength(parts[i]);
+			const HashPlan plan(total, Capac, BlkA, BlkB);
+			digest_type out;
+			hash(plan, parts, count, arena, out.data());
+			std::fill(arena.begin(), arena.begin() + std::min(arena.size(), plan.arenaSize), 0); //basic memory sanitation
+			if (arena.size() > keptArena) {arena.clear(); arena.shrink_to_fit();}
+			return out;
+		}
+		static size_t partLength(const bytespan& p) noexcept {return p.size;}
+		static size_t partLength(const struct iovec& p) noexcept {return p.iov_len;}
+	};
 }
 }
 
@@ -0,0 +1,53 @@
+#ifndef erclib_threading_included
+#define erclib_threading_included
+
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+typedef unsigned int uint;
+
+namespace ERCLIB {
+namespace Threading {
+	//! Thread count to use when the caller asks for "all of them"; never zero
+	inline uint defaultWorkers() {
+		const uint n = std::thread::hardware_concurrency();
+		return n ? n : 1;
+	}
+	
+	/********!
+	 * @brief
+	 * 			Calls <CODE>fn(first, last, worker)</CODE> over contiguous
+	 * 			slices of [0, count), on up to \c workers threads.
+	 * 
+	 * @details
+	 * 			The calling thread takes the first slice itself, so one
+	 * 			worker (or one item) never starts a thread at all. Slices
+	 * 			are fixed up front, so anything that writes to offsets
+	 * 			known ahead of time gets the same result for any count.
+	 * 
+	 * @note
+	 * 			Templates stay in the header, like the ones in customizable.hpp.
+	 ********/
+	template<class F> void forRange(size_t count, uint workers, F&& fn) {
+		if (workers > count) workers = uint(count);
+		if (workers <= 1) {
+			fn(size_t(0), count, uint(0));
+			return;
+		}
+		std::vector<std::thread> pool;
+		pool.reserve(workers - 1);
+		const size_t per = count / workers, over = count % workers;
+		size_t first = per + (over ? 1 : 0);
+		for (uint t = 1; t < workers; t++) {
+			const size_t last = first + per + ((t < over) ? 1 : 0);
+			pool.emplace_back([&fn, first, last, t]() {fn(first, last, t);});
+			first = last;
+		}
+		fn(size_t(0), per + (over ? 1 : 0), uint(0));
+		for (std::thread& i : pool) i.join();
+	}
+}
+}
+
+#endif
@@ -67,8 +67,37 @@
  */
 
 #include "viper-1.hpp"
+#include "bytes.hpp"
+#include "threading.hpp"
+#include <algorithm>
+#include <stdexcept>
 namespace ERCLIB {
 	namespace VIPER1 {
+		namespace {
+			//! For IVs and nonces at the encrypt/decrypt boundary, which must be exactly one half
+			Half toHalf(const bytevec& in) {
+				if (in.size() != 12) throw std::invalid_argument("VIPER-1 IVs and nonces must be 12 bytes!");
+				Half N;
+				std::copy(in.begin(), in.end(), N.begin());
+				return N;
+			}
+			//! The \c funcs:: adapters keep their old contract: only the first 12 entries are read
+			Half leadingHalf(const bytevec& in) {
+				assert(in.size() >= 12);
+				Half N;
+				std::copy(in.begin(), in.begin() + 12, N.begin());
+				return N;
+			}
+			Block toBlock(const bytevec& left, const bytevec& right) {
+				return {leadingHalf(left), leadingHalf(right)};
+			}
+			vecpair toPair(const Block& in) {
+				return {bytevec(in[0].begin(), in[0].end()), bytevec(in[1].begin(), in[1].end())};
+			}
+			void checkBlocks(size_t len) {
+				if (len % 24 != 0) throw std::invalid_argument("VIPER-1 CBC input must be whole 24-byte blocks!");
+			}
+		}
 		namespace funcs {
 			inline const bytevec reverseVector(const bytevec input) {
 				bytevec temp(input.size(), 0);
@@ -88,6 +117,162 @@ namespace ERCLIB {
 				}
 				return n;
 			}
+			//! Makes a key byte usable as a Reverse-Multiply multiplier; only odd bytes have inverses mod 256
+			byte revmultKey(byte k) {
+				if (inverseKeyMod(k) == 255) k >>= 2;
+				if (k == 0) {k = 1;}
+				if (!(k & 1)) k += 1;  // This is a catch, in case we can't use our key very well  (even #s cannot be inverted for this)
+				return k;
+			}
+			
+			//! The block engine: everything below works on fixed 12-byte halves
+			//! held on the stack, so a block costs no allocations. The bytevec
+			//! functions further down are adapters over these.
+			Block revmultEnc(const Block& in, const RoundKey& rk) {
+				Block N;
+				for (byte i = 0; i < 12; i++) {
+					N[0][i] = rk.encB[in[1][i]];
+					N[1][i] = rk.encA[in[0][11 - i]];
+				}
+				return N;
+			}
+			Block revmultDec(const Block& in, const RoundKey& rk) {
+				Block N;
+				for (byte i = 0; i < 12; i++) {
+					N[0][i] = rk.decA[in[1][11 - i]];
+					N[1][i] = rk.decB[in[0][i]];
+				}
+				return N;
+			}
+			Block arxEnc(const Block& in, const byte a, const byte b) {
+				// Add a, rotate by a certain factor, XOR b
+				byte BaseS = a + b;
+				Block N;
+				for (byte i = 0; i < 12; i++) {
+					byte A = in[0][i] + a, B = in[1][i] + a, rot = (short(BaseS) + short(i)) % 8;
+					if (rot == 0) {
+						N[0][i] = B ^ b;
+						N[1][i] = A ^ b;
+					} else {
+						N[0][i] = ((A >> rot) | (B << (8 - rot))) ^ b;
+						N[1][i] = ((B >> rot) | (A << (8 - rot))) ^ b;
+					}
+				}
+				return N;
+			}
+			Block arxDec(const Block& in, const byte a, const byte b) {
+				byte BaseS = a + b;
+				Block N;
+				for (byte i = 0; i < 12; i++) {
+					byte A = in[0][i] ^ b, B = in[1][i] ^ b, rot = (short(BaseS) + short(i)) % 8;
+					if (rot == 0) {
+						N[0][i] = B - a;
+						N[1][i] = A - a;
+					} else {
+						byte Ar = (A << rot) | (B >> (8 - rot));
+						byte Br = (B << rot) | (A >> (8 - rot));
+						N[0][i] = Ar - a;
+						N[1][i] = Br - a;
+					}
+				}
+				return N;
+			}
+			Half roundFunction(const Half& diff, const RoundKey& rk) {
+				Half N;
+				for (byte i = 0; i < 12; i++) N[i] = rk.roundTable[diff[i]];
+				return N;
+			}
+			Half add(const Half& to, const Half& rnd) {
+				Half N;
+				for (byte i = 0; i < 12; i++) N[i] = to[i] + rnd[i];
+				return N;
+			}
+			Half diff(const Half& left, const Half& right) {
+				Half N;
+				for (byte i = 0; i < 12; i++) N[i] = left[i] - right[i];
+				return N;
+			}
+			Block midXOR(const Block& in, const byte lK, const byte rK) {
+				Block N;
+				for (byte i = 0; i < 12; i++) {
+					N[0][i] = in[0][i] ^ lK;
+					N[1][i] = in[1][i] ^ rK;
+				}
+				return N;
+			}
+			Block XORvecs(const Block& l, const Block& r) {
+				Block N;
+				for (byte i = 0; i < 12; i++) {
+					N[0][i] = l[0][i] ^ r[0][i];
+					N[1][i] = l[1][i] ^ r[1][i];
+				}
+				return N;
+			}
+			Block permuteEnc(const Block& in, const byte key) {
+				Half lv, rv; //Divides each byte in two, placing one in either side.
+				for (byte i = 0; i < 12; i++) {
+					byte L = in[0][i] ^ key;
+					byte R = in[1][i];
+					lv[i] = (L >> 4) | (R << 4); // NL = R4 R5 R6 R7 L0 L1 L2 L3
+					rv[i] = (L << 4) | (R >> 4); // NR = L4 L5 L6 L7 R0 R1 R2 R3
+				}
+				Block N;
+				for (byte i = 0; i < 12; i++) { //Mix them around from opposite sides
+					byte L = lv[i];
+					byte R = rv[11 - i];
+					N[0][i] = (R >> 2) | (L << 6); // NL = L6 L7 R0 R1 R2 R3 R4 R5
+					N[1][i] = (L >> 2) | (R << 6); // NR = R6 R7 L0 L1 L2 L3 L4 L5
+				}
+				for (byte i = 0; i < 12; i++) {
+					N[0][i] ^= key + byte((12 * ushort(i)) % (key + 1));
+					N[1][i] ^= ~key - byte((15 * ushort(i)) % (key + 1));
+				}
+				for (byte i = 0; i < 12; i++) {
+					byte L = N[0][i];
+					N[1][11 - i] ^= (key ^ L) - i;
+					N[1][i] ^= L + i;
+				}
+				byte shiftB = key % 8;
+				for (byte i = 0; i < 12; i++) {
+					byte R = N[1][i], L = N[0][i], shift = (shiftB + i) % 8;
+					N[0][i] = ((R >> shift) | (L << (8 - shift))) ^ key;
+					N[1][i] = ~((L >> shift) | (R << (8 - shift)));
+				}
+				return N;
+			}
+			Block permuteDec(const Block& in, const byte key) {
+				Block N;
+				byte shiftB = key % 8;
+				for (byte i = 0; i < 12; i++) {
+					byte R = ~in[1][i], L = in[0][i] ^ key, shift = (shiftB + i) % 8;
+					N[0][i] = (L >> (8 - shift)) | (R << shift);
+					N[1][i] = (R >> (8 - shift)) | (L << shift);
+				}
+				for (byte i = 0; i < 12; i++) {
+					byte L = N[0][i];
+					N[1][11 - i] ^= (key ^ L) - i;
+					N[1][i] ^= L + i;
+				}
+				Half lv, rv;
+				for (byte i = 0; i < 12; i++) {
+					lv[i] = N[0][i] ^ (key + byte((12 * ushort(i)) % (key + 1)));
+					rv[i] = N[1][i] ^ (~key - byte((15 * ushort(i)) % (key + 1)));
+				}
+				for (byte i = 0; i < 12; i++) {
+					byte L = lv[i];
+					byte R = rv[i];
+					N[0][i] = (L >> 6) | (R << 2);
+					N[1][11 - i] = (R >> 6) | (L << 2);
+				}
+				for (byte i = 0; i < 12; i++) {
+					byte L = N[0][i];
+					byte R = N[1][i];
+					lv[i] = ((R >> 4) | (L << 4)) ^ key;
+					rv[i] = (R << 4) | (L >> 4);
+				}
+				N = {lv, rv};
+				return N;
+			}
 			//! toggles between 'revmult' and 'arx' for the half-round function used
 			//! which hRf we start with, and then how we order our mixes, are from the key.
 			
@@ -109,13 +294,7 @@ namespace ERCLIB {
 			inline const vecpair revmultEnc(const bytevec input1, const bytevec input2, const byte a, const byte b) {
 				// Note: if one key is correct, then half the data is correct. KEEP IN MIND.
 				assert(input1.size() == input2.size());
-				byte kA = a, kB = b;
-				if (inverseKeyMod(kA) == 255) kA >>= 2;
-				if (inverseKeyMod(kB) == 255) kB >>= 2;
-				if (kA == 0) {kA = 1;} 
-				if (kB == 0) {kB = 1;}
-				if (!(kA & 1)) kA += 1;  // This is a catch, in case we can't use our key very well  (even #s cannot be inverted for this)
-				if (!(kB & 1)) kB += 1;
+				const byte kA = revmultKey(a), kB = revmultKey(b);
 				bytevec A = reverseVector(input1), B = input2, c, d;
 				for (byte i : A) {
 					c.push_back(ushort((ushort(i) * kA) + (b >> 4)) % 256);
@@ -128,13 +307,7 @@ namespace ERCLIB {
 			}
 			inline const vecpair revmultDec(const bytevec input1, const bytevec input2, const byte a, const byte b) {
 				assert(input1.size() == input2.size());
-				byte kA = a, kB = b;
-				if (inverseKeyMod(kA) == 255) kA >>= 2; // First insurance that the key is usable
-				if (inverseKeyMod(kB) == 255) kB >>= 2;
-				if (kA == 0) {kA = 1;} 
-				if (kB == 0) {kB = 1;}
-				if (!(kA & 1)) kA += 1;  // This is a catch, in case we can't use our key very well (even #s cannot be inverted for this)
-				if (!(kB & 1)) kB += 1;
+				const byte kA = revmultKey(a), kB = revmultKey(b);
 				byte ia = inverseKeyMod(kA), ib = inverseKeyMod(kB);
 				bytevec A = input2, B = input1, c, d;
 				for (byte i : A) {
@@ -146,47 +319,22 @@ namespace ERCLIB {
 				vecpair N = {reverseVector(c), d};
 				return N;
 			}
+			//! As above, through \c rk's tables
+			const vecpair revmultEnc(const bytevec& input1, const bytevec& input2, const RoundKey& rk) {
+				assert(input1.size() == input2.size());
+				return toPair(revmultEnc(toBlock(input1, input2), rk));
+			}
+			const vecpair revmultDec(const bytevec& input1, const bytevec& input2, const RoundKey& rk) {
+				assert(input1.size() == input2.size());
+				return toPair(revmultDec(toBlock(input1, input2), rk));
+			}
 			inline const vecpair arxEnc(const bytevec input1, const bytevec input2, const byte a, const byte b) {
-				// Add rotate XOR
-				// Add a, rotate by a certain factor, XOR b
-				// this doesn't swap the "effective" left and right, because the rotation style sorta does already.
-				byte BaseS = a + b;
-				bytevec iA, iB;
 				assert(input1.size() == input2.size());
-				for (byte i=0; i<12;i++) {
-					byte A = input1[i] + a, B = input2[i] + a, rot = (short(BaseS) + short(i)) % 8;
-					if (rot == 0) {
-						iA.push_back(B ^ b);
-						iB.push_back(A ^ b);
-					} else {
-						iA.push_back(((A >> rot) | (B << (8 - rot))) ^ b);
-						iB.push_back(((B >> rot) | (A << (8 - rot))) ^ b);
-					}
-					
-				}
-				vecpair N = {iA, iB};
-				return N;
+				return toPair(arxEnc(toBlock(input1, input2), a, b));
 			}
 			inline const vecpair arxDec(const bytevec input1, const bytevec input2, const byte a, const byte b) {
-				byte BaseS = a + b;
-				bytevec iA, iB;
 				assert(input1.size() == input2.size());
-				for (byte i=0; i<12;i++) {
-					byte A = input1[i] ^ b, B = input2[i] ^ b, rot = (short(BaseS) + short(i)) % 8;
-					if (rot == 0) {
-						iA.push_back(B - a);
-						iB.push_back(A - a);
-					} else {
-						byte Ar = (A << rot); // first half
-						byte Br = (B << rot);
-						Ar |= (B >> (8 - rot));
-						Br |= (A >> (8 - rot));
-						iA.push_back(Ar - a);
-						iB.push_back(Br - a);
-					}
-				}
-				vecpair N = {iA, iB};
-				return N;
+				return toPair(arxDec(toBlock(input1, input2), a, b));
 			}
 			inline const bytevec roundFunction(const bytevec diff, const byte key) {
 				// XORs key-and-input "duality modulo" with a blended rotation and XOR of the input and key.
@@ -199,21 +347,22 @@ namespace ERCLIB {
 				}
 				return tmp;
 			}
-			inline const bytevec add(const bytevec to, const bytevec rnd) {
+			//! As above, one table lookup per byte
+			const bytevec roundFunction(const bytevec& diff, const RoundKey& rk) {
 				bytevec tmp;
-				assert(to.size() == rnd.size());
-				for (byte i = 0; i < 12; i++) {
-					tmp.push_back(to[i] + rnd[i]);
-				}
+				tmp.reserve(diff.size());
+				for (byte i : diff) tmp.push_back(rk.roundTable[i]);
 				return tmp;
 			}
+			inline const bytevec add(const bytevec to, const bytevec rnd) {
+				assert(to.size() == rnd.size());
+				const Half out = add(leadingHalf(to), leadingHalf(rnd));
+				return bytevec(out.begin(), out.end());
+			}
 			inline const bytevec diff(const bytevec left, const bytevec right) {
-				bytevec tmp;
 				assert(left.size() == right.size());
-				for (byte i = 0; i < 12; i++) {
-					tmp.push_back(left[i] - right[i]);
-				}
-				return tmp;
+				const Half out = diff(leadingHalf(left), leadingHalf(right));
+				return bytevec(out.begin(), out.end());
 			}
 			inline const vecpair midXOR(const bytevec left, const bytevec right, const byte lK, const byte rK) {
 				bytevec lv, rv;
@@ -228,16 +377,8 @@ namespace ERCLIB {
 				return N;
 			}
 			const vecpair XORvecs(const vecpair l, const vecpair r) {
-				bytevec lv, rv;
 				assert(l[0].size() == r[0].size()); assert(l[1].size() == r[1].size());
-				for (byte i = 0; i < 12; i++) {
-					lv.push_back(l[0][i] ^ r[0][i]);
-				}
-				for (byte i = 0; i < 12; i++) {
-					rv.push_back(l[1][i] ^ r[1][i]);
-				}
-				vecpair N = {lv, rv};
-				return N;
+				return toPair(XORvecs(toBlock(l[0], l[1]), toBlock(r[0], r[1])));
 			}
 			//! Permutation box-like function
 			//! Splits the input bytes in half and sends them across two byte vectors,
@@ -247,84 +388,105 @@ namespace ERCLIB {
 			//! of the data, and finally doing a swap-and-rotation permutation.
 			//! this adds 256 bits of dependence in a 1,920-bit message (2:15 ratio).
 			const vecpair permuteEnc(const vecpair in, const byte key) {
-				// Two-way permutation function
-				// Does split and XOR  to permute some of the bits of our input
-				bytevec lv, rv; //Divides each byte in two, placing one in either side.
-				for (byte i = 0; i < 12; i++) {
-					byte L = in[0][i] ^ key;
-					byte R = in[1][i];
-					lv.push_back((L >> 4) | (R << 4)); // NL = R4 R5 R6 R7 L0 L1 L2 L3
-					rv.push_back((L << 4) | (R >> 4)); // NR = L4 L5 L6 L7 R0 R1 R2 R3
-				}
-				vecpair N;
-				for (byte i = 0; i < 12; i++) { //Mix them around from opposite sides
-					byte L = lv[i];
-					byte R = rv[11 - i];
-					N[0].push_back((R >> 2) | (L << 6)); // NL = L6 L7 R0 R1 R2 R3 R4 R5
-					N[1].push_back((L >> 2) | (R << 6)); // NR = R6 R7 L0 L1 L2 L3 L4 L5
-				}
-				for (byte i = 0; i < 12; i++) {
-					N[0][i] ^= key + byte((12 * ushort(i)) % (key + 1));
-					N[1][i] ^= ~key - byte((15 *  ushort(i)) % (key + 1));
-				}
-				for (byte i = 0; i < 12; i++) {
-					byte L = N[0][i];
-					N[1][11- i] ^= (key ^ L) - i;
-					N[1][i] ^= L + i;
-				}
-				byte shiftB = key % 8;
-				for (byte i = 0; i < 12; i++) {
-					byte R = N[1][i], L = N[0][i], shift = (shiftB + i) % 8;
-					N[0][i] =  ((R >> shift) | (L << (8 - shift))) ^ key;
-					N[1][i] = ~((L >> shift) | (R << (8 - shift)));
-				}
-				return N;
+				return toPair(permuteEnc(toBlock(in[0], in[1]), key));
 			}
 			const vecpair permuteDec(const vecpair in, const byte key) {
-				bytevec lv, rv; //Divides each byte in two, placing one in either side.
-				//Also implement a Cipher Block Chaining-like mode here?
-				vecpair N; N[0].reserve(12); N[1].reserve(12);
-				byte shiftB = key % 8;
-				for (byte i = 0; i < 12; i++) {
-					byte R = ~in[1][i], L = in[0][i] ^ key, shift = (shiftB + i) % 8;;
-					/*                                            //if shift = 2
-					N[0][i] = (R >> shift) | (L << (8 - shift));  //L6 L7 R0 R1 R2 R3 R4 R5
-					N[1][i] = (L >> shift) | (R << (8 - shift));  //R6 R7 L0 L1 L2 L3 L4 L5
-					*/
-					N[0][i] = ((L >> (8 - shift)) | (R << shift));
-					N[1][i] = ((R >> (8 - shift)) | (L << shift));
-				}
-				for (byte i = 0; i < 12; i++) {
-					byte L = N[0][i];
-					N[1][11- i] ^= (key ^ L) - i;
-					N[1][i] ^= L + i;
-				}
-				for (byte i = 0; i < 12; i++) {
-					byte L = N[0][i] ^ (key + byte((12 *  ushort(i)) % (key + 1)));
-					lv.push_back(L);
-					rv.push_back(N[1][i] ^ (~key - byte((15 *  ushort(i)) % (key + 1))));
-				}
-				N[0].clear(); N[1].clear(); 
-				N[0].reserve(12); N[1].reserve(12);
-				for (byte i = 0; i < 12; i++) {
-					byte L = lv[i];
-					byte R = rv[i];
-					N[0][i] = ((L >> 6) | (R << 2));
-					N[1][11 - i] = ((R >> 6) | (L << 2));
-				}
-				lv.clear(); rv.clear();
-				for (byte i = 0; i < 12; i++) {
-					byte L = N[0][i];
-					byte R = N[1][i];
-					lv.push_back(((R >> 4) | (L << 4)) ^ key);
-					rv.push_back(((R << 4) | (L >> 4)));
+				return toPair(permuteDec(toBlock(in[0], in[1]), key));
+			}
+		}
+		/********!
+		 * @brief
+		 * 			Works out the schedule bytes and the sixteen round keys,
+		 * 			exactly as \c encrypt() always has per call.
+		 * 
+		 * @details
+		 * 			The schedule bytes come from XORs of eight-byte runs of the
+		 * 			key (the seventh run takes byte 56 where 55 might be
+		 * 			expected; ciphertexts depend on it, so it stays).
+		 * 
+		 * @exception std::invalid_argument
+		 * 			If \c key is not 60 bytes.
+		 ********/
+		KeySchedule::KeySchedule(const bytevec& key) {
+			if (key.size() != 60) throw std::invalid_argument("VIPER-1 keys must be 60 bytes!");
+			byte s[7];
+			for (byte r = 0; r < 7; r++) {
+				s[r] = 0;
+				for (byte i = 0; i < 8; i++) s[r] ^= key[(r * 8) + i];
+			}
+			s[6] ^= key[55] ^ key[56];
+			this->sched1 = (((s[0] * s[1]) + s[4]) % 256) ^ key[57] ^ (s[6] & key[59]);
+			this->sched2 = (((s[2] * s[3]) + s[5]) % 256) ^ key[58] ^ (s[6] & key[59]);
+			
+			const std::bitset<8> first(this->sched1), second(this->sched2);
+			bytevec every(256);
+			for (ushort i = 0; i < 256; i++) every[i] = byte(i);
+			for (byte r = 0; r < 16; r++) {
+				RoundKey& R = this->rounds[r];
+				for (byte i = 0; i < 5; i++) R.k[i] = (r < 12) ? key[(r * 5) + i] : byte(0xA5);
+				R.arx = (r < 8) ? first[r] : second[r - 8];
+				R.mulA = funcs::revmultKey(R.k[0]);
+				R.mulB = funcs::revmultKey(R.k[1]);
+				R.invA = funcs::inverseKeyMod(R.mulA);
+				R.invB = funcs::inverseKeyMod(R.mulB);
+				const bytevec table = funcs::roundFunction(every, R.k[4]);
+				for (ushort i = 0; i < 256; i++) {
+					R.roundTable[i] = table[i];
+					R.encA[i] = ushort((i * R.mulA) + (R.k[1] >> 4)) % 256;
+					R.encB[i] = ushort((i * R.mulB) + (R.k[0] >> 4)) % 256;
+					R.decA[i] = ushort((i - (R.k[1] >> 4)) * R.invA) % 256;
+					R.decB[i] = ushort((i - (R.k[0] >> 4)) * R.invB) % 256;
 				}
-				//! @bug the Front and Back halves of the data seem switched, but modifying the step above didn't help.
-				//! Fixed this - forgot that the 'right' output is flipped during the encryption-side.
-				N = {lv, rv};
-				return N;
 			}
 		}
+		KeySchedule::~KeySchedule() {
+			Bytes::wipe(this->rounds.data(), sizeof(this->rounds)); //basic memory sanitation; the tables give the key bytes away too
+			Bytes::wipe(&this->sched1, sizeof(this->sched1));
+			Bytes::wipe(&this->sched2, sizeof(this->sched2));
+		}
+		
+		//! \c round_enc() for one precomputed round, on the stack
+		Block round_enc(const Block& in, const RoundKey& rk) {
+			Block N = funcs::permuteEnc(in, rk.k[0]);
+			N = rk.arx ? funcs::arxEnc(N, rk.k[0], rk.k[1]) : funcs::revmultEnc(N, rk);
+			N = funcs::midXOR(N, rk.k[2], rk.k[3]);
+			const Half Round = funcs::roundFunction(funcs::diff(N[0], N[1]), rk);
+			N = {funcs::add(N[1], Round), funcs::add(N[0], Round)};
+			return funcs::permuteEnc(N, rk.k[4]);
+		}
+		Block round_dec(const Block& in, const RoundKey& rk) {
+			const Block J = funcs::permuteDec(in, rk.k[4]);
+			const Half Round = funcs::roundFunction(funcs::diff(J[1], J[0]), rk); //Un-Flip
+			Block N = {funcs::diff(J[1], Round), funcs::diff(J[0], Round)};
+			N = funcs::midXOR(N, rk.k[2], rk.k[3]);
+			N = rk.arx ? funcs::arxDec(N, rk.k[0], rk.k[1]) : funcs::revmultDec(N, rk);
+			return funcs::permuteDec(N, rk.k[0]);
+		}
+		Block cycle_enc(const Block& in, const KeySchedule& ks) {
+			Block N = in;
+			for (byte r = 0; r < 16; r++) N = round_enc(N, ks.rounds[r]);
+			return N;
+		}
+		Block cycle_dec(const Block& in, const KeySchedule& ks) {
+			Block N = in;
+			for (byte r = 16; r-- > 0;) N = round_dec(N, ks.rounds[r]);
+			return N;
+		}
+		const vecpair round_enc(const vecpair& in, const RoundKey& rk) {
+			return toPair(round_enc(toBlock(in[0], in[1]), rk));
+		}
+		const vecpair round_dec(const vecpair& in, const RoundKey& rk) {
+			return toPair(round_dec(toBlock(in[0], in[1]), rk));
+		}
+		const vecpair cycle_enc(const vecpair& in, const KeySchedule& ks) {
+			assert(in[0].size() == in[1].size());
+			return toPair(cycle_enc(toBlock(in[0], in[1]), ks));
+		}
+		const vecpair cycle_dec(const vecpair& in, const KeySchedule& ks) {
+			assert(in[0].size() == in[1].size());
+			return toPair(cycle_dec(toBlock(in[0], in[1]), ks));
+		}
+		
 		inline const vecpair round_enc(const vecpair in, const bool Func, const bytevec* key, const byte keyStart) {
 			//Add 5 to keyStart's parent when done
 
@@ -410,103 +572,173 @@ namespace ERCLIB {
 			N = round_dec(N, schedule[0][0], key, 0);
 			return N;
 		}
-		//! Redesigned this to: 1. have better scheduling 2. support Cipher-block chaining 3. fix encrypt/decrypt bug
-		const bytevec encrypt(const bytevec input, const bytevec key, const bytevec IV) {
-			assert(key.size() == 60); assert(input.size() >= 24);
-			assert(input.size() % 24  == 0); assert(IV.size() == 12);
-			//! Acquire preliminary scheduling matrix by doing a LOT of XORs.
-			byte sA = key.at(0) ^ key[1] ^ key[2] ^ key[3] ^ key[4] ^ key[5] ^ key[6] ^ key[7];
-			byte sB = key[8] ^ key[9] ^ key[10] ^ key[11] ^  key[12] ^ key[13] ^ key[14] ^ key[15];
-			byte sC = key[16] ^ key[17] ^ key[18] ^ key[19] ^ key[20] ^ key[21] ^ key[22] ^ key[23];
-			byte sD = key[24] ^ key[25] ^ key[26] ^ key[27] ^ key[28] ^ key[29] ^ key[30] ^ key[31];
-			byte sE = key[32] ^ key[33] ^ key[34] ^ key[35] ^ key[36] ^ key[37] ^ key[38] ^ key[39];
-			byte sF = key[40] ^ key[41] ^ key[42] ^ key[43] ^ key[44] ^ key[45] ^ key[46] ^ key[47];
-			byte sG = key[48] ^ key[49] ^ key[50] ^ key[51] ^ key[52] ^ key[53] ^ key[54] ^ key[56];
-			//! Define true scheduling matrix by using Modular multiplication and some more XORs
-			byte sched1 = (((sA * sB) + sE) % 256) ^ key[57] ^ (sG & key[59]);
-			byte sched2 = (((sC * sD) + sF) % 256) ^ key[58] ^ (sG & key[59]);
-			//assert(0 == 1); //! this was to see where the segmentation fault was
-			//! make it into booleans
-			std::vector<std::bitset<8>> SchedMatrix = {sched1, sched2}; //sleazy little conversion
+		namespace {
+			Block loadBlock(const byte* in) {
+				Block N;
+				std::copy(in, in + 12, N[0].begin());
+				std::copy(in + 12, in + 24, N[1].begin());
+				return N;
+			}
+			void storeBlock(const Block& N, byte* out) {
+				std::copy(N[0].begin(), N[0].end(), out);
+				std::copy(N[1].begin(), N[1].end(), out + 12);
+			}
+			//! The chaining value before the first block: the IV, then the IV backwards
+			Block firstLink(const Half& IV) {
+				Block N = {IV, IV};
+				std::reverse(N[1].begin(), N[1].end());
+				return N;
+			}
+			//! Blocks per thread below which a parallel decrypt isn't worth starting threads for
+			const size_t sliceBlocks = 256;
 			
-			// split up input into blocks
-			std::vector<vecpair> Pairs; vecpair TempPair;
-			byte Tl=0, Tr=0; bool Right = 0;
-			for (byte i : input) {
-				if (Right) {
-					TempPair[1].push_back(i);
-					Tr++;
-					if (Tr == 12) {
-						Right = 0; Tl = 0; Tr = 0;
-						Pairs.push_back(TempPair);
-						TempPair[0].clear(); TempPair[1].clear();
-					}
-				} else {
-					TempPair[0].push_back(i);
-					Tl++;
-					if (Tl == 12) Right = 1;
-				} 
-			}
-			bytevec Output1;
-			vecpair last = {IV, funcs::reverseVector(IV)};
-			for (vecpair E : Pairs) {
-				assert(E[0].size() == 12);
-				assert(E[1].size() == 12);
-				vecpair N = funcs::XORvecs(E, last);
-				N = cycle_enc(N, &key, SchedMatrix);
-				last = funcs::permuteEnc(N, sched1 ^ sched2);
-				for (byte i : N[0]) Output1.push_back(i);
-				for (byte i : N[1]) Output1.push_back(i);
-			}
-			return Output1;
+			//! CBC decryption of whole blocks, chaining on from \c last
+			void decryptFrom(const byte* in, size_t len, byte* out, const KeySchedule& ks, Block last) {
+				for (size_t b = 0; b < len; b += 24) {
+					const Block E = loadBlock(in + b);
+					Block N = funcs::XORvecs(cycle_dec(E, ks), last);
+					last = funcs::permuteEnc(E, ks.chainKey());
+					storeBlock(N, out + b);
+					Bytes::wipe(&N, sizeof(N)); //basic memory sanitation
+				}
+			}
 		}
-		const bytevec decrypt(const bytevec input,  const bytevec key, const bytevec IV) {
-			assert(key.size() == 60); assert(input.size() >= 24);
-			assert(input.size() % 24  == 0); assert(IV.size() == 12);
-			//! Acquire preliminary scheduling matrix by doing a LOT of XORs.
-			byte sA = key.at(0) ^ key.at(1) ^ key.at(2) ^ key.at(3) ^ key.at(4) ^ key.at(5) ^ key.at(6) ^ key.at(7);
-			byte sB = key.at(8) ^ key.at(9) ^ key.at(10) ^ key.at(11) ^  key.at(12) ^ key.at(13) ^ key.at(14) ^ key.at(15);
-			byte sC = key.at(16) ^ key.at(17) ^ key.at(18) ^ key.at(19) ^ key.at(20) ^ key.at(21) ^ key.at(22) ^ key.at(23);
-			byte sD = key.at(24) ^ key.at(25) ^ key.at(26) ^ key.at(27) ^ key.at(28) ^ key.at(29) ^ key.at(30) ^ key.at(31);
-			byte sE = key.at(32) ^ key.at(33) ^ key.at(34) ^ key.at(35) ^ key.at(36) ^ key.at(37) ^ key.at(38) ^ key.at(39);
-			byte sF = key.at(40) ^ key.at(41) ^ key.at(42) ^ key.at(43) ^ key.at(44) ^ key.at(45) ^ key.at(46) ^ key.at(47);
-			byte sG = key.at(48) ^ key.at(49) ^ key.at(50) ^ key.at(51) ^ key.at(52) ^ key.at(53) ^ key.at(54) ^ key.at(56);
-			//! Define true scheduling matrix by using Modular multiplication and some more XORs
-			byte sched1 = (((sA * sB) + sE) % 256) ^ key.at(57) ^ (sG & key.at(59));
-			byte sched2 = (((sC * sD) + sF) % 256) ^ key.at(58) ^ (sG & key.at(59));
-			//! make it into booleans
-			std::vector<std::bitset<8>> SchedMatrix = {sched1, sched2}; //sleazy little conversion
-			
-			// split up input into blocks
-			std::vector<vecpair> Pairs; vecpair TempPair;
-			byte Tl=0, Tr=0; bool Right = 0;
-			for (byte i : input) {
-				if (Right) {
-					TempPair[1].push_back(i);
-					Tr++;
-					if (Tr == 12) {
-						Right = 0; Tl = 0; Tr = 0;
-						Pairs.push_back(TempPair);
-						TempPair[0].clear(); TempPair[1].clear();
-					}
-				} else {
-					TempPair[0].push_back(i);
-					Tl++;
-					if (Tl == 12) Right = 1;
-				} 
-			}
-			bytevec Output;
-			vecpair last = {IV, funcs::reverseVector(IV)};
-			assert(last[1].size() == 12);
-			for (vecpair E : Pairs) {
-				vecpair N = cycle_dec(E, &key, SchedMatrix);
-				N = funcs::XORvecs(N, last);
-				last = funcs::permuteEnc(E, sched1 ^ sched2);
-				for (byte i : N[0]) Output.push_back(i);
-				for (byte i : N[1]) Output.push_back(i);
+		
+		//! Redesigned this to: 1. have better scheduling 2. support Cipher-block chaining 3. fix encrypt/decrypt bug
+		//! Each block is loaded before its output is stored, so \c out may be \c in.
+		void encrypt(const byte* in, size_t len, byte* out, const KeySchedule& ks, const Half& IV) {
+			checkBlocks(len);
+			Block last = firstLink(IV);
+			for (size_t b = 0; b < len; b += 24) {
+				Block N = funcs::XORvecs(loadBlock(in + b), last);
+				N = cycle_enc(N, ks);
+				last = funcs::permuteEnc(N, ks.chainKey());
+				storeBlock(N, out + b);
 			}
+		}
+		void decrypt(const byte* in, size_t len, byte* out, const KeySchedule& ks, const Half& IV) {
+			checkBlocks(len);
+			decryptFrom(in, len, out, ks, firstLink(IV));
+		}
+		/********!
+		 * @brief
+		 * 			As above, with the blocks split over up to \c workers
+		 * 			threads; the output is the same as the serial one.
+		 * 
+		 * @details
+		 * 			A block's chaining value is \c permuteEnc() of the
+		 * 			ciphertext block before it, never of anything decrypted,
+		 * 			so each slice only needs the block just ahead of it. Those
+		 * 			are all read before any thread starts, which keeps an in
+		 * 			place decrypt safe. Slices are at least \c sliceBlocks
+		 * 			long, so short messages stay on the calling thread.
+		 ********/
+		void decrypt(const byte* in, size_t len, byte* out, const KeySchedule& ks, const Half& IV, uint workers) {
+			checkBlocks(len);
+			const size_t blocks = len / 24;
+			if (workers > blocks / sliceBlocks) workers = uint(blocks / sliceBlocks);
+			if (workers <= 1) {
+				decryptFrom(in, len, out, ks, firstLink(IV));
+				return;
+			}
+			const size_t per = (blocks + workers - 1) / workers, slices = (blocks + per - 1) / per;
+			std::vector<Block> links(slices);
+			links[0] = firstLink(IV);
+			for (size_t i = 1; i < slices; i++) links[i] = funcs::permuteEnc(loadBlock(in + (((i * per) - 1) * 24)), ks.chainKey());
+			Threading::forRange(slices, workers, [&](size_t first, size_t last, uint) {
+				for (size_t i = first; i < last; i++) {
+					const size_t from = i * per * 24, to = std::min(blocks, (i + 1) * per) * 24;
+					decryptFrom(in + from, to - from, out + from, ks, links[i]);
+				}
+			});
+		}
+		const bytevec encrypt(const bytevec& input, const KeySchedule& ks, const bytevec& IV) {
+			assert(input.size() >= 24);
+			assert(input.size() % 24  == 0);
+			bytevec Output(input.size());
+			encrypt(input.data(), input.size(), Output.data(), ks, toHalf(IV));
 			return Output;
 		}
+		const bytevec decrypt(const bytevec& input, const KeySchedule& ks, const bytevec& IV) {
+			assert(input.size() >= 24);
+			assert(input.size() % 24  == 0);
+			bytevec Output(input.size());
+			decrypt(input.data(), input.size(), Output.data(), ks, toHalf(IV));
+			return Output;
+		}
+		const bytevec decrypt(const bytevec& input, const KeySchedule& ks, const bytevec& IV, uint workers) {
+			assert(input.size() >= 24);
+			assert(input.size() % 24  == 0);
+			bytevec Output(input.size());
+			decrypt(input.data(), input.size(), Output.data(), ks, toHalf(IV), workers);
+			return Output;
+		}
+		
+		namespace {
+			//! Keystream block \c index: the nonce, then the index big-endian in the last eight bytes
+			Block counterBlock(const Half& nonce, uint64_t index) {
+				Block N = {nonce, Half()};
+				for (byte i = 0; i < 8; i++) N[1][11 - i] = byte(index >> (8 * i));
+				return N;
+			}
+		}
+		/********!
+		 * @brief
+		 * 			Counter mode: XORs \c len bytes with the keystream
+		 * 			starting \c offset bytes in, so encrypting and decrypting
+		 * 			are the same call.
+		 * 
+		 * @details
+		 * 			Keystream block \c i is \c cycle_enc() of the nonce and
+		 * 			\c i. No block depends on another, so any byte offset can
+		 * 			be jumped to directly, nothing is padded, and the blocks
+		 * 			split over up to \c workers threads (in slices of at least
+		 * 			\c sliceBlocks). \c out may be \c in.
+		 * 
+		 * @note
+		 * 			Never use a nonce twice under one key: the two messages
+		 * 			would share a keystream, and XORing their ciphertexts
+		 * 			cancels it out.
+		 * 
+		 * @exception std::invalid_argument
+		 * 			From the \c bytevec overloads, if \c nonce is not 12 bytes.
+		 ********/
+		void encrypt_ctr(const byte* in, size_t len, byte* out, const KeySchedule& ks, const Half& nonce, uint64_t offset, uint workers) {
+			if (len == 0) return;
+			const uint64_t start = offset / 24;
+			const size_t skip = offset % 24, blocks = (skip + len + 23) / 24;
+			if (workers > blocks / sliceBlocks) workers = uint(blocks / sliceBlocks);
+			Threading::forRange(blocks, workers, [&](size_t first, size_t last, uint) {
+				for (size_t b = first; b < last; b++) {
+					Block K = cycle_enc(counterBlock(nonce, start + b), ks);
+					const size_t from = (b == 0) ? skip : 0, to = std::min(size_t(24), skip + len - (b * 24));
+					for (size_t i = from; i < to; i++) {
+						const size_t at = (b * 24) + i - skip;
+						out[at] = in[at] ^ K[i / 12][i % 12];
+					}
+					Bytes::wipe(&K, sizeof(K)); //basic memory sanitation
+				}
+			});
+		}
+		void decrypt_ctr(const byte* in, size_t len, byte* out, const KeySchedule& ks, const Half& nonce, uint64_t offset, uint workers) {
+			encrypt_ctr(in, len, out, ks, nonce, offset, workers);
+		}
+		const bytevec encrypt_ctr(const bytevec& input, const KeySchedule& ks, const bytevec& nonce, uint64_t offset, uint workers) {
+			const Half N = toHalf(nonce);
+			bytevec Output(input.size());
+			encrypt_ctr(input.data(), input.size(), Output.data(), ks, N, offset, workers);
+			return Output;
+		}
+		const bytevec decrypt_ctr(const bytevec& input, const KeySchedule& ks, const bytevec& nonce, uint64_t offset, uint workers) {
+			return encrypt_ctr(input, ks, nonce, offset, workers);
+		}
+		//! Builds the key schedule for this one call; reuse a KeySchedule instead when encrypting more than once
+		const bytevec encrypt(const bytevec input, const bytevec key, const bytevec IV) {
+			return encrypt(input, KeySchedule(key), IV);
+		}
+		const bytevec decrypt(const bytevec input,  const bytevec key, const bytevec IV) {
+			return decrypt(input, KeySchedule(key), IV);
+		}
 	}
 	//! Idea for full implementation
 	//! have a header chunk with three bytes, and then all necessary null bytes PRIOR to data - byte #1 and #2 are a magic number; #3 is the number of padded null bytes
@@ -533,4 +765,11 @@ namespace ERCLIB {
 		}
 		return newer;
 	}
+	//! Counter-mode counterparts: no header or padding, so the ciphertext is exactly as long as the plaintext
+	const bytevec encryptData_VIPER1_CTR(const bytevec& Plaintext, const bytevec& Key, const bytevec& Nonce) {
+		return VIPER1::encrypt_ctr(Plaintext, VIPER1::KeySchedule(Key), Nonce);
+	}
+	const bytevec decryptData_VIPER1_CTR(const bytevec& Ciphertext, const bytevec& Key, const bytevec& Nonce) {
+		return VIPER1::decrypt_ctr(Ciphertext, VIPER1::KeySchedule(Key), Nonce);
+	}
 }
@@ -6,6 +6,7 @@
 #include <cassert>
 #include <bitset>
 #include <string>
+#include <cstdint>
 
 typedef unsigned char byte;
 typedef std::vector<unsigned char> bytevec;
@@ -13,21 +14,85 @@ typedef std::array<bytevec, 2> vecpair;
 
 namespace ERCLIB {
 	namespace VIPER1 {
+		//! The block engine's types: a 24-byte block is two 12-byte halves, with no heap behind them
+		typedef std::array<byte, 12> Half;
+		typedef std::array<Half, 2> Block;
+		
+		/********!
+		 * @brief
+		 * 			The five key bytes one round uses, and lookup tables for
+		 * 			everything that only depends on them.
+		 * 
+		 * @details
+		 * 			\c roundTable[i] is the round function of byte \c i under
+		 * 			\c k[4], so its per-byte division is done once, here. The
+		 * 			four Reverse-Multiply tables map a byte through each
+		 * 			multiply-and-add (or subtract-and-multiply) in one lookup.
+		 ********/
+		struct RoundKey {
+			byte k[5]; //permute and half-round A, half-round B, mid-XOR left, mid-XOR right, round function and last permute
+			bool arx; //the half-round is Add-Rotate-XOR if set, Reverse-Multiply if not
+			byte mulA, mulB, invA, invB; //Reverse-Multiply's multipliers from k[0] and k[1], and their inverses mod 256
+			byte roundTable[256];
+			byte encA[256], encB[256], decA[256], decB[256];
+		};
+		
+		/********!
+		 * @brief
+		 * 			Everything \c encrypt() and \c decrypt() derive from a key,
+		 * 			worked out once.
+		 * 
+		 * @details
+		 * 			Holds the two schedule bytes, and all sixteen rounds: twelve
+		 * 			from the key itself, then four from the fixed 0xA5 bytes. Each
+		 * 			round picks its half-round from the schedule, and carries the
+		 * 			adjusted Reverse-Multiply multipliers and their inverses, so
+		 * 			\c inverseKeyMod() never runs per block. Build one per key and
+		 * 			reuse it for every message under that key.
+		 ********/
+		class KeySchedule {
+		public:
+			std::array<RoundKey, 16> rounds;
+			byte sched1, sched2;
+			
+			explicit KeySchedule(const bytevec& key);
+			~KeySchedule();
+			
+			std::vector<std::bitset<8>> matrix() const {return {this->sched1, this->sched2};}
+			byte chainKey() const {return this->sched1 ^ this->sched2;} //permutes each ciphertext block into the next block's chaining value
+		};
+		
 		namespace funcs {
 			//Two different, invertible half-round functions
 			extern const bytevec reverseVector(const bytevec input);
 			extern const byte inverseKeyMod(const byte i);
 			extern const vecpair revmultEnc(const bytevec input1, const bytevec input2, const byte a, const byte b);
 			extern const vecpair revmultDec(const bytevec input1, const bytevec input2, const byte a, const byte b);
+			extern byte revmultKey(byte k);
+			extern const vecpair revmultEnc(const bytevec& input1, const bytevec& input2, const RoundKey& rk);
+			extern const vecpair revmultDec(const bytevec& input1, const bytevec& input2, const RoundKey& rk);
 			extern const vecpair arxEnc(const bytevec input1, const bytevec input2, const byte a, const byte b);
 			extern const vecpair arxDec(const bytevec input1, const bytevec input2, const byte a, const byte b);
 			extern const bytevec roundFunction(bytevec diff, const byte key);
+			extern const bytevec roundFunction(const bytevec& diff, const RoundKey& rk);
 			extern const bytevec add(const bytevec to, const bytevec rnd);
 			extern const bytevec diff(const bytevec left, const bytevec right);
 			extern const vecpair midXOR(const bytevec left, const bytevec right, const byte lK, const byte rK);
 			extern const vecpair XORvecs(const vecpair l, const vecpair r);
 			extern const vecpair permuteEnc(const vecpair in, const byte key);
 			extern const vecpair permuteDec(const vecpair in, const byte key);
+			
+			extern Block revmultEnc(const Block& in, const RoundKey& rk);
+			extern Block revmultDec(const Block& in, const RoundKey& rk);
+			extern Block arxEnc(const Block& in, const byte a, const byte b);
+			extern Block arxDec(const Block& in, const byte a, const byte b);
+			extern Half roundFunction(const Half& diff, const RoundKey& rk);
+			extern Half add(const Half& to, const Half& rnd);
+			extern Half diff(const Half& left, const Half& right);
+			extern Block midXOR(const Block& in, const byte lK, const byte rK);
+			extern Block XORvecs(const Block& l, const Block& r);
+			extern Block permuteEnc(const Block& in, const byte key);
+			extern Block permuteDec(const Block& in, const byte key);
 		}
 		extern const vecpair round_enc(const vecpair in, const bool Func, const bytevec* key, const byte keyStart);
 		extern const vecpair round_dec(const vecpair in, const bool Func, const bytevec* key, const byte keyStart);
@@ -35,10 +100,33 @@ namespace ERCLIB {
 		extern const vecpair cycle_dec(const vecpair in, const bytevec* key, const std::vector<std::bitset<8>> schedule);
 		extern const bytevec encrypt(const bytevec input, const bytevec key, const bytevec IV);
 		extern const bytevec decrypt(const bytevec input, const bytevec key, const bytevec IV);
+		extern const vecpair round_enc(const vecpair& in, const RoundKey& rk);
+		extern const vecpair round_dec(const vecpair& in, const RoundKey& rk);
+		extern const vecpair cycle_enc(const vecpair& in, const KeySchedule& ks);
+		extern const vecpair cycle_dec(const vecpair& in, const KeySchedule& ks);
+		extern const bytevec encrypt(const bytevec& input, const KeySchedule& ks, const bytevec& IV);
+		extern const bytevec decrypt(const bytevec& input, const KeySchedule& ks, const bytevec& IV);
+		extern Block round_enc(const Block& in, const RoundKey& rk);
+		extern Block round_dec(const Block& in, const RoundKey& rk);
+		extern Block cycle_enc(const Block& in, const KeySchedule& ks);
+		extern Block cycle_dec(const Block& in, const KeySchedule& ks);
+		//! CBC over \c len bytes (a multiple of 24) with no allocations; \c out may be \c in
+		extern void encrypt(const byte* in, size_t len, byte* out, const KeySchedule& ks, const Half& IV);
+		extern void decrypt(const byte* in, size_t len, byte* out, const KeySchedule& ks, const Half& IV);
+		//! Decrypts on up to \c workers threads (see Threading::defaultWorkers()), with the same output as above
+		extern void decrypt(const byte* in, size_t len, byte* out, const KeySchedule& ks, const Half& IV, uint workers);
+		extern const bytevec decrypt(const bytevec& input, const KeySchedule& ks, const bytevec& IV, uint workers);
+		//! Counter mode over any length, from any byte \c offset of the keystream; \c nonce is 12 bytes, never reused under one key
+		extern void encrypt_ctr(const byte* in, size_t len, byte* out, const KeySchedule& ks, const Half& nonce, uint64_t offset = 0, uint workers = 1);
+		extern void decrypt_ctr(const byte* in, size_t len, byte* out, const KeySchedule& ks, const Half& nonce, uint64_t offset = 0, uint workers = 1);
+		extern const bytevec encrypt_ctr(const bytevec& input, const KeySchedule& ks, const bytevec& nonce, uint64_t offset = 0, uint workers = 1);
+		extern const bytevec decrypt_ctr(const bytevec& input, const KeySchedule& ks, const bytevec& nonce, uint64_t offset = 0, uint workers = 1);
 	}
 	extern const std::string convertBytesToStr(const bytevec N);
 	extern const bytevec encryptData_VIPER1(const bytevec Plaintext, const bytevec Key, const bytevec IV);
 	extern const bytevec decryptData_VIPER1(const bytevec Ciphertext, const bytevec Key, const bytevec IV);
+	extern const bytevec encryptData_VIPER1_CTR(const bytevec& Plaintext, const bytevec& Key, const bytevec& Nonce);
+	extern const bytevec decryptData_VIPER1_CTR(const bytevec& Ciphertext, const bytevec& Key, const bytevec& Nonce);
 }
 
 #endif